@@ -7,20 +7,273 @@
  *
  *********************************************************/
 
+#define _GNU_SOURCE
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "dpu.h"
 
 
+/* Instructions executed since the DPU started */
+static __thread uint64_t icount;
+
+/* Reason the program was stopped by a fault */
+static __thread uint8_t fault;
+
+
+/* Alarms and interrupts 
+ *
+ *  alarm_next - Instruction count at which to look at the alarms again.
+ *    flag_irq - Set while an interrupt is being handled.
+ * irq_pending - An interrupt is waiting to be taken.
+ */
+static __thread struct dpu_alarm alarms[ALARM_SLOTS];
+static __thread unsigned int alarm_count;
+static __thread uint64_t alarm_next = NO_LIMIT;
+static __thread uint32_t timer_period;
+static __thread uint32_t timer_vector;
+static __thread uint8_t flag_irq;
+static __thread uint8_t irq_pending;
+
+
+/* MMU
+ *
+ *  tlb_read... - TLBs for loads, stores and fetches, by MMU_ access.
+ */
+static __thread uint8_t mmu_on;
+static __thread uint32_t mmu_table;
+static __thread uint32_t mmu_fault;
+static __thread struct dpu_tlb tlb_read[TLB_SIZE];
+static __thread struct dpu_tlb tlb_write[TLB_SIZE];
+static __thread struct dpu_tlb tlb_exec[TLB_SIZE];
+
+
+/* Exclusive monitor 
+ *
+ *  reserved - Set by LDX, and cleared by STX or a change of context.
+ *   reserve - Address and value loaded by the last LDX.
+ */
+static __thread uint8_t reserved;
+static __thread uint32_t reserve_addr;
+static __thread uint32_t reserve_value;
+
+
+/* Multi-core
+ *
+ *    smp_cores - Cores running, 0 outside of multi-core runs.
+ *  code_shared - Bytes of each page that some core has decoded blocks 
+ *                from.
+ *   code_epoch - Bumped by a store into code in a shared page; a core 
+ *                seeing it change throws its blocks away.
+ */
+static unsigned int smp_cores;
+static struct dpu_span code_shared[CODE_PAGES];
+static uint32_t code_epoch;
+static __thread uint32_t core_epoch;
+
+
+/* Fuzzing 
+ *
+ *   cov_map - Edge coverage of the current run, NULL when not fuzzing.
+ *  cov_prev - Previous branch location, for hashing the edge.
+ */
+static uint8_t * cov_map;
+static uint32_t cov_prev;
+static uint64_t fuzz_rng;
+
+
+/* Metrics
+ *
+ *      counts - Counters of this thread, which only ever go up.
+ *       tally - Instance this thread is running, if any.
+ *  tally_base - counts and icount when last added into tally.
+ *  tally_next - Instruction count to add into tally again at.
+ */
+static __thread struct dpu_metrics counts;
+static __thread struct dpu_metrics * tally;
+static __thread struct dpu_metrics tally_base;
+static __thread uint64_t tally_icount;
+static __thread uint64_t tally_next = NO_LIMIT;
+static struct dpu_metrics main_metrics;
+static struct dpu_census census[CENSUS_SLOTS];
+static pthread_mutex_t census_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t export_thread;
+static unsigned char * export_file;
+static uint8_t export_stop;
+static const struct dpu_family families[] = {
+    {"dpu_instructions_total", "Instructions retired.", offsetof(struct dpu_metrics, instructions)},
+    {"dpu_branches_total", "Branches taken.", offsetof(struct dpu_metrics, branches)},
+    {"dpu_loads_total", "LDR and LDB instructions.", offsetof(struct dpu_metrics, loads)},
+    {"dpu_stores_total", "STR and STB instructions.", offsetof(struct dpu_metrics, stores)},
+    {"dpu_pushes_total", "PSH instructions.", offsetof(struct dpu_metrics, pushes)},
+    {"dpu_pulls_total", "PUL instructions.", offsetof(struct dpu_metrics, pulls)},
+    {"dpu_stops_total", "STOP instructions.", offsetof(struct dpu_metrics, stops)}
+};
+static const char * const fault_names[FAULT_KINDS] = {"none", "mem", "align", "idle", "page"};
+
+
+/* Engines 
+ *
+ *  engine_kind - Engine this thread runs with.  Cores and guests of the
+ *                pool run the fast engine.
+ */
+static __thread unsigned int engine_kind;
+static struct dpu_debug debug;
+
+
+/* Sampling
+ *
+ *  sample_state - State translated code is running from on this thread,
+ *                 which the PC is taken from instead, if any.
+ */
+static struct dpu_sampler sampler;
+static __thread struct dpu_state * volatile sample_state;
+
+
+/* Cache simulation
+ *
+ *  cache_batch - Accesses not yet fed to the model.
+ *     cache_pc - Address of the instruction the cache engine is running.
+ */
+static struct dpu_caches caches;
+static struct dpu_access cache_batch[CACHE_BATCH];
+static unsigned int cache_count;
+static uint32_t cache_pc;
+
+
+/* Record and replay 
+ *
+ *  bus_replay - Recording that device loads are taken from while it is
+ *               replayed, when devices themselves are left alone.
+ *   recording - Set on the thread whose run is recorded, or kept in the
+ *               history.  Cores and guests run on other threads, and 
+ *               their events belong to neither.
+ */
+static FILE * rec_file;
+static struct dpu_replay * replay;
+static struct dpu_replay * bus_replay;
+static __thread uint8_t recording;
+
+
+/* Reverse execution: the history kept, NULL when not keeping it */
+static struct dpu_history * history;
+
+
+/* Snapshot stream being written, NULL when none */
+static struct dpu_stream * stream;
+
+
+/* Names of the op numbers */
+static const char * const mnemonics[OP_COUNT] = {
+    "AND", "EOR", "SUB", "SXB", "ADD", "ADC", "LSR", "LSL",
+    "TST", "TEQ", "CMP", "ROR", "ORR", "MOV", "BIC", "MVN",
+    "LDR", "STR", "LDB", "STB", "MOVI", "CMPI", "ADDI", "SUBI",
+    "B<cc>", "PSH", "PUL", "BRA", "BRL", "STOP", "SWP", "LDX",
+    "STX", "CPY", "FIL", "EXT"
+};
+
+
+/* Devices */
+static struct dpu_device bus[DEV_SLOTS];
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dpu_console console;
+static struct dpu_disk disk;
+
+
+/* Block engine 
+ *
+ *  code_pages - Decoded pages of memory, NULL until code is run there.
+ *     retired - Pages dropped after a store, freed once nothing runs them.
+ *     dropped - Common pages dropped, given back to the cache once 
+ *               nothing runs them.  A page can only be taken again once
+ *               those dropped have been given back, so there are never 
+ *               more than CODE_PAGES.
+ *  block_exit - Set to leave the current block after this instruction.
+ *   bus_count - Device accesses made, to tell a loop that polls a 
+ *               device from one that is idle.
+ * code_common - Set on threads that take common pages from the cache.
+ * code_written - Pages the program has stored into since the last flush.
+ *                They are given private pages, so that data stored next
+ *                to code does not keep dropping a common page.
+ */
+static __thread struct dpu_page * code_pages[CODE_PAGES];
+static __thread struct dpu_page * retired;
+static __thread struct dpu_page * dropped[CODE_PAGES];
+static __thread unsigned int dropped_count;
+static __thread struct dpu_ras ras[RAS_SIZE];
+static __thread unsigned int ras_top;
+static __thread unsigned int ras_count;
+static __thread uint8_t block_exit;
+static __thread uint64_t bus_count;
+static __thread uint8_t code_common;
+static __thread uint8_t code_written[CODE_PAGES];
+
+
+/* Common page cache, by hash of the page bytes and page number.  made
+ * and joined count the pages put in the cache and the times a thread
+ * took one already there. */
+static struct dpu_page * page_cache[PAGE_BUCKETS];
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int pages_made;
+static unsigned int pages_joined;
+
+
+/* Translated image 
+ *
+ *  aot_map   - Marks the addresses where translated code can be entered.
+ *  aot_pages - Code pages holding translated code.
+ *  aot_valid - Set while memory matches the words translated.
+ */
+static void * aot_handle;
+static int (*aot_image)(struct dpu_state *, unsigned char *, const uint8_t *, const struct dpu_io *);
+static const uint32_t * aot_addr;
+static const uint32_t * aot_ir;
+static unsigned int aot_count;
+static uint8_t * aot_map;
+static uint8_t aot_pages[CODE_PAGES];
+static __thread uint8_t aot_valid;
+static const void * const * aot_host;
+
+
+/* Jitdump
+ *
+ *  jit_marker - The dump mapped executable, which perf record sees.
+ *   jit_index - Code load records written.
+ */
+static FILE * jit_file;
+static void * jit_marker;
+static uint64_t jit_index;
+
+
+/* Engines built from engine.h, by ENGINE_ number */
+static const struct dpu_engine engines[ENGINES] = {
+    {dpu_instFetch, dpu_execute, dpu_runBlock},
+    {dpu_instFetchCover, dpu_executeCover, dpu_runBlockCover},
+    {dpu_instFetchDebug, dpu_executeDebug, dpu_runBlockDebug},
+    {dpu_instFetchCache, dpu_executeCache, dpu_runBlockCache}
+};
+
+
 /**
  *	DPU startup function that initializes memory and provides 
  *	an everlasting loop.  An input character  is taken and 
  *	handled according to the available options.
  */
 int dpu_start(){
-    unsigned char memory[MEM_SIZE];
+    _Alignas(uint32_t) unsigned char memory[MEM_SIZE];
     unsigned char choice[BUFF_SIZE];
     unsigned char flush[BUFF_SIZE];
     unsigned int offset, length, i;
@@ -28,6 +281,9 @@ int dpu_start(){
 
     /* Reset registers */
     dpu_reset();
+    dpu_busInit();
+    dpu_tallyTo(&main_metrics);
+    dpu_enroll(CENSUS_MAIN, "main", &main_metrics, sizeof(main_metrics), 1);
     
     /*  Print title and command list */
     printf("    |=-=-=-=-=-=-=-=-=--->>DPU<<---=-=-=-=-=-=-=-=-=|\n"); 
@@ -35,7 +291,9 @@ int dpu_start(){
     
     /*  Loop forever */
     forever{
-        // Prompt
+        // Prompt, after any output the program left in the console
+        dpu_conFlush();
+        dpu_tally();
         printf("> ");
 
         // Obtain a choice from the user/stdin
@@ -48,6 +306,15 @@ int dpu_start(){
         
         // Switch to execture correct function 
         switch(choice[0]){
+            case 'a':
+                dpu_attach(memory);
+                break;
+            case 'b':
+                dpu_diskAttach();
+                break;
+            case 'c':
+                dpu_translate(memory);
+                break;
             case 'd':
                 printf("Enter offset in hex:\t");
                 // Test for a valid intake
@@ -73,19 +340,39 @@ int dpu_start(){
                 
                 dpu_dump(memory, offset, length);
                 break;
+            case 'f':
+                dpu_historyFree();
+                dpu_fuzz(memory);
+                break;
             case 'g':
-                
-                 while(!flag_stop){
-                    dpu_instCycle(memory);
-                 }
-                 
+                dpu_select();
+                if(history != NULL || stream != NULL){
+                    dpu_runMarked(memory, NO_LIMIT);
+                }else{
+                    dpu_run(memory, NO_LIMIT, 0);
+                }
+                if(debug.hit){
+                    printf("Breakpoint at %08X.\n", PC);
+                }
+                break;
+            case 'i':
+                dpu_select();
+                dpu_pairs(memory);
+                break;
+            case 'k':
+                dpu_cacheSim(memory);
                 break;
             case 'l':
                 bytes = dpu_LoadFile(memory, MEM_SIZE);
                 if(bytes >= 0){
                     printf("0x%x(%d) bytes have been loaded into memory from file.\n", (unsigned int)bytes, (unsigned int)bytes);        
+                    dpu_flush();
+                    dpu_recordEvent(EV_MEMORY, 0, bytes, memory);
                 }    
                 break;
+            case 'n':
+                dpu_stream(memory);
+                break;
             case 'm':
                 printf("Enter offset in hex:\t");
                 // Ensure proper value is taken in
@@ -101,23 +388,62 @@ int dpu_start(){
                     break;
                 }    
                        
-                dpu_modify(memory, offset);
+                length = dpu_modify(memory, offset);
+                dpu_flush();
+                dpu_recordEvent(EV_MEMORY, offset, length, (unsigned char *)memory + offset);
+                break;
+            case 'e':
+                dpu_record(memory);
+                break;
+            case 'o':
+                dpu_metricsSet();
+                break;
+            case 'p':
+                dpu_sched(memory);
                 break;
             case 'q':
+                if(rec_file != NULL){
+                    dpu_record(memory);
+                }
+                if(export_file != NULL){
+                    dpu_metricsSet();
+                }
+                dpu_streamStop(memory);
                 printf("Goodbye.\n");
                 return dpu_quit();
             case 'r':
                 dpu_reg();
                 break;
+            case 's':
+                dpu_smp(memory);
+                break;
             case 't':
+                dpu_select();
+                if(icount >= alarm_next){
+                    dpu_alarms(memory);
+                }
                 dpu_instCycle(memory);  
                 dpu_reg();
                 break;
+            case 'u':
+                dpu_reverse(memory);
+                break;
+            case 'v':
+                dpu_lanes(memory);
+                break;
             case 'w':
                 dpu_WriteFile(memory);
                 break;
+            case 'x':
+                dpu_debugSet(memory);
+                break;
+            case 'y':
+                dpu_historyFree();
+                dpu_replay(memory);
+                break;
             case 'z':
                 dpu_reset();
+                dpu_recordEvent(EV_RESET, 0, 0, NULL);
                 printf("Registers have been reset.\n");
                 break;
             // If the user selects '?' then the case will fall into 'h'
@@ -259,12 +585,14 @@ int dpu_LoadFile(void * memory, unsigned int max){
 /**
  *  Memory Modify:  
  *      Modify bytes of memory, in hex, beginning at offset.
+ *      Returns the number of bytes modified.
  */
 int dpu_modify(void * memptr, unsigned int offset){
     unsigned char input[BUFF_SIZE];
     unsigned char flush[BUFF_SIZE];
     unsigned int byte;
     unsigned int i;
+    unsigned int start = offset;
     
     printf("*All byte values accepted in hex.*\nEnter '.' to stop.\n\n");
 
@@ -311,7 +639,7 @@ int dpu_modify(void * memptr, unsigned int offset){
             break;
         }    
     }
-    return 0;
+    return offset - start;
 }    
 
 int dpu_quit(){
@@ -347,6 +675,32 @@ int dpu_reg(){
 
     /* Print non-visible registers */
     printf("\n   MAR:%08X   MBR:%08X   IR0:%04X   IR1:%04X   Stop:%0d   IR Flag:%01d\n",  mar,  mbr, IR0, IR1, flag_stop, flag_ir);
+    printf("   Ops: %s, %s\n", mnemonics[dpu_op(IR0)], mnemonics[dpu_op(IR1)]);
+
+    /* Print the fault that stopped the program, if any */
+    if(fault == FAULT_MEM){
+        printf("   Fault: memory access out of range at %08X\n", mar);
+    }else if(fault == FAULT_ALIGN){
+        printf("   Fault: atomic access not word aligned at %08X\n", mar);
+    }else if(fault == FAULT_IDLE){
+        printf("   Fault: idle loop with nothing to end it at %08X\n", PC);
+    }else if(fault == FAULT_PAGE){
+        printf("   Fault: page not mapped for the access at %08X\n", mmu_fault);
+    }
+    if(fault != FAULT_NONE && (dpu_op(cir) == OP_CPY || dpu_op(cir) == OP_FIL)){
+        printf("   %s stopped with %u bytes left\n", mnemonics[dpu_op(cir)], regfile[0]);
+    }
+
+    /* Print the timer, if it is in use */
+    if(timer_period != 0 || flag_irq || irq_pending){
+        printf("   Timer period:%08X   Vector:%08X   In IRQ:%d   Pending:%d\n", 
+            timer_period, timer_vector, flag_irq, irq_pending);
+    }
+
+    /* Print the MMU, if it is on */
+    if(mmu_on){
+        printf("   MMU table:%08X   Last fault:%08X\n", mmu_table, mmu_fault);
+    }
 
     return 0;
 }
@@ -429,391 +783,5074 @@ int dpu_reset(){
     flag_carry = 0;
     flag_stop = 0;
     flag_ir = 0;
+    fault = FAULT_NONE;
     // Non-visible registers
     mar = 0;
     mbr = 0;
     ir = 0;
     // Unofficial current instruction register
     cir = 0;
+    // Timer and interrupts
+    alarm_count = 0;
+    timer_period = 0;
+    timer_vector = 0;
+    flag_irq = 0;
+    irq_pending = 0;
+    dpu_alarmNext();
+    // MMU
+    mmu_on = 0;
+    mmu_table = 0;
+    mmu_fault = 0;
     
     return 0;
 }
 
 
-/**
- * Help:  Function to print DPU options to the user
- *	      in the form of a menu.
- */
-void dpu_help(){
-    printf("\td\tdump memory\n"
-            "\tg\tgo - run the entire program\n"
-            "\tl\tload a file into memory\n"
-            "\tm\tmemory modify\n"
-            "\tq\tquit\n"
-            "\tr\tdisplay registers\n"
-            "\tt\ttrace - execute one instruction\n"
-            "\tw\twrite file\n"
-            "\tz\treset all registers to zero\n"
-            "\t?, h\tdisplay list of commands\n");
-}
-
-
 /********************************************************************
- * Instruction Cycle:   
- *      An instruction cycle consists of a fetch, which provides two 
- *      instructions, and an execute for each of said instructions.  
- *      An IR flag is uses to determine the which instruction is to be
- *      executed from either 16-bit IR0 or IR1 of the 32-bit 
- *      Instruction Register.  If the flag is high, IR1 will be executed,
- *      then the flag will be set low.  If the flag is low, a fetch is made,
- *      providing IR0 and IR1 with the new instructions, and the flag is 
- *      then set high.  
- *
+ * Translate:  Translate the program in memory to C, to be built as a 
+ *             shared object and attached with dpu_attach().  The control
+ *             flow is followed from an entry address through fall-through,
+ *             B/BL targets, conditional branch targets and the returns of
+ *             BL.  Each pair reached becomes a labelled piece of C that
+ *             does exactly what the instruction cycle would do to the 
+ *             registers, flags and memory.  Jumps whose target is only
+ *             known at run time, such as a PUL-return, go through a switch
+ *             on the PC that hands back to the interpreter on a miss.
+ *             Pairs holding an extended instruction are not translated,
+ *             so the interpreter runs them.
  ***********************************************************************/
-void dpu_instCycle(void * memory){
-    /* Determine which IR to use via IR Active flag */
-    if(flag_ir == 0){
-        flag_ir = 1;
-        /* Fetch new set of instructions */
-        dpu_fetch(memory);
-        /* Current instruction is now IR0 */
-        cir = IR0;
-        dpu_execute(memory);
-    }else{
-        flag_ir = 0;
-        cir = IR1;
-        dpu_execute(memory);
-    }     
-}
+int dpu_translate(void * memory){
+    FILE * out;
+    unsigned char * mem = memory;
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    unsigned char flush[BUFF_SIZE];
+    uint8_t * nodes;
+    uint32_t * work;
+    uint32_t entry, addr, word, target;
+    unsigned int top = 0, count = 0;
+    int slot, flags;
+    uint16_t cir;
 
+    printf("Enter entry address in hex:\t");
+    if(scanf("%x", &entry) == 0 || entry > MEM_SIZE - REG_SIZE){
+        printf("Not a valid address.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
 
-/********************************************************
- * Fetch:  Fetch an instruction from memory, at the address
- *         of the program counter.  Memory is 8 bits, and so
- *         4 bytes must be collected into the MBR, starting at the
- *         memory offset specified by MAR, as the Memory Buffer 
- *         Register is 32 bits.  This requires bit shifting 8 bits 
- *         to the left for each byte.  Doing this 4 times will equate 
- *         to 32 bits read.  The PC is incremented by the size of one
- *         register/instruction after the contents of MBR are stored in
- *         the Instruction Register.
- **************************************************************/         
-void dpu_fetch(void * memory){
-    /* MAR <- PC */
-   // mar = PC;
-    
-    ir = dpu_loadReg(PC, memory);
-    
-    /* PC + 1 instruction */
-    PC += REG_SIZE;
-}
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
 
-/***************************************************************
- * Load Register: Load a register with memory at location of MAR.
- *                MAR must be set before this function is called.
- ******************************************************************/
-uint32_t dpu_loadReg(uint32_t marValue, void * memory){
-    unsigned int i;
+    nodes = calloc(MEM_SIZE, 1);
+    work = malloc(MEM_SIZE * sizeof(uint32_t));
+    if(nodes == NULL || work == NULL){
+        perror("translate: malloc");
+        free(nodes);
+        free(work);
+        return -1;
+    }
 
-    mar = marValue;
+    /* Recover the control flow graph, one pair per node */
+    nodes[entry] = NODE_AOT;
+    work[top++] = entry;
+    while(top > 0){
+        addr = work[--top];
+        word = (uint32_t)mem[addr] << SHIFT_3BYTE | mem[addr + 1] << SHIFT_2BYTE
+            | mem[addr + 2] << SHIFT_BYTE | mem[addr + 3];
 
-    /* MBR <- memory[MAR] */        /* PC <- + 1 instruction */
-    for(i = 0; i < CYCLES; i++, mar++){
-        mbr = mbr << SHIFT_BYTE;
-        /* Add memory at mar to mbr */
-        mbr += *((unsigned char*)memory + mar);
-    }     
+        for(slot = 0; slot < 2; slot++){
+            cir = slot == 0 ? word >> SHIFT_2BYTE : word & 0xFFFF;
+            flags = 0;
+            target = MEM_SIZE;
+            if(COND_BRANCH){
+                target = addr + REG_SIZE + (int8_t)(COND_ADDR) - (slot == 0 ? THUMB_SIZE : 0);
+                if(AL){
+                    flags = EMIT_END;
+                }
+            }else if(BRANCH){
+                target = OFFSET12;
+                flags = EMIT_END;
+                /* The call returns to the next pair */
+                if(LINK_BIT && addr + REG_SIZE <= MEM_SIZE - REG_SIZE && !nodes[addr + REG_SIZE]){
+                    nodes[addr + REG_SIZE] = NODE_AOT;
+                    work[top++] = addr + REG_SIZE;
+                }
+            }else if(((PUSH_PULL) && LOAD_BIT && RET_BIT) || STOP){
+                flags = EMIT_END;
+            }else if(EXTENDED){
+                nodes[addr] = NODE_INTERP;
+            }
+            if(target <= MEM_SIZE - REG_SIZE && !nodes[target]){
+                nodes[target] = NODE_AOT;
+                work[top++] = target;
+            }
+            if(flags & EMIT_END){
+                break;
+            }
+        }
+        if(nodes[addr] == NODE_AOT){
+            count++;
+        }
+        if(slot == 2 && addr + REG_SIZE <= MEM_SIZE - REG_SIZE && !nodes[addr + REG_SIZE]){
+            nodes[addr + REG_SIZE] = NODE_AOT;
+            work[top++] = addr + REG_SIZE;
+        }
+    }
+    free(work);
 
-    /* Register <- MBR */
-    return mbr;    
-}
+    if((out = fopen(filename, "w")) == NULL){
+        sprintf(error, "translate: fopen: %s", filename);
+        perror(error);
+        free(nodes);
+        return -1;
+    }
 
-/***************************************************************
- * Store Register: Store an entire register into memory at MAR.
- *                 
- ******************************************************************/
-void dpu_storeReg(uint32_t marValue, uint32_t mbrValue, void * memory){
-    
-    mar = marValue;
-    mbr = mbrValue;
+    /* Helpers matching dpu_loadReg() and dpu_storeReg() */
+    fprintf(out, 
+        "/*\n"
+        " * Translated by dpu from entry 0x%04X, %u pairs.\n"
+        " * Build: cc -O2 -shared -fPIC -I<dpu source> %s -o <image>.so\n"
+        " */\n"
+        "#include \"dpu.h\"\n\n"
+        "#define FLAGS(v) (s->flag_zero = (v) == 0, s->flag_sign = ((v) & MSB32_MASK) >> MSBTOLSB)\n"
+        "#define LOAD(a) load(s, m, io, (a))\n"
+        "#define STORE(a, v) store(s, m, code, io, (a), (v), &leave)\n\n"
+        "static uint32_t load(struct dpu_state * s, unsigned char * m, const struct dpu_io * io, uint32_t a){\n"
+        "    if(a > MEM_SIZE - CYCLES){\n"
+        "        s->mar = a;\n"
+        "        if(DEV_HIT(a)){\n"
+        "            s->mbr = io->load(s, a, m);\n"
+        "            return s->mbr;\n"
+        "        }\n"
+        "        s->flag_stop = 1;\n"
+        "        s->fault = s->fault ? s->fault : FAULT_MEM;\n"
+        "        return 0;\n"
+        "    }\n"
+        "    s->mar = a + CYCLES;\n"
+        "    s->mbr = (uint32_t)m[a] << SHIFT_3BYTE | m[a + 1] << SHIFT_2BYTE | m[a + 2] << SHIFT_BYTE | m[a + 3];\n"
+        "    return s->mbr;\n"
+        "}\n\n"
+        "static void store(struct dpu_state * s, unsigned char * m, const uint8_t * code, const struct dpu_io * io,\n"
+        "        uint32_t a, uint32_t v, int * leave){\n"
+        "    s->mbr = v;\n"
+        "    if(a > MEM_SIZE - CYCLES){\n"
+        "        s->mar = a;\n"
+        "        if(DEV_HIT(a)){\n"
+        "            *leave |= io->store(s, a, v, m);\n"
+        "            return;\n"
+        "        }\n"
+        "        s->flag_stop = 1;\n"
+        "        s->fault = s->fault ? s->fault : FAULT_MEM;\n"
+        "        return;\n"
+        "    }\n"
+        "    if(code[a >> PAGE_SHIFT] || code[(a + 3) >> PAGE_SHIFT]){\n"
+        "        *leave |= DEV_CODE;\n"
+        "    }\n"
+        "    s->mar = a + 3;\n"
+        "    m[a] = v >> SHIFT_3BYTE;\n"
+        "    m[a + 1] = v >> SHIFT_2BYTE;\n"
+        "    m[a + 2] = v >> SHIFT_BYTE;\n"
+        "    m[a + 3] = v;\n"
+        "}\n\n",
+        entry, count, filename);
 
-    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_3BYTE & BYTE_MASK);
-    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_2BYTE & BYTE_MASK);
-    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_BYTE & BYTE_MASK);
-    *((unsigned char*)memory + mar) = (unsigned char)mbr & BYTE_MASK;
+    fprintf(out, "const uint32_t dpu_image_abi = AOT_ABI;\n\n");
+    fprintf(out, "const unsigned int dpu_image_count = %u;\n\n", count);
+    fprintf(out, "const uint32_t dpu_image_addr[] = {");
+    for(addr = 0, top = 0; addr < MEM_SIZE; addr++){
+        if(nodes[addr] == NODE_AOT){
+            fprintf(out, "%s0x%04X,", top++ % 8 ? " " : "\n    ", addr);
+        }
+    }
+    fprintf(out, "\n};\n\nconst uint32_t dpu_image_ir[] = {");
+    for(addr = 0, top = 0; addr < MEM_SIZE; addr++){
+        if(nodes[addr] == NODE_AOT){
+            word = (uint32_t)mem[addr] << SHIFT_3BYTE | mem[addr + 1] << SHIFT_2BYTE
+                | mem[addr + 2] << SHIFT_BYTE | mem[addr + 3];
+            fprintf(out, "%s0x%08XU,", top++ % 6 ? " " : "\n    ", word);
+        }
+    }
+    fprintf(out, "\n};\n\nconst void * const * dpu_image_host;\n\n");
+
+    fprintf(out, 
+        "int dpu_image(struct dpu_state * s, unsigned char * m, const uint8_t * code, const struct dpu_io * io){\n"
+        "    static const void * const host[] = {");
+    for(addr = 0, top = 0; addr < MEM_SIZE; addr++){
+        if(nodes[addr] == NODE_AOT){
+            fprintf(out, "%s&&L_%04X,", top++ % 6 ? " " : "\n        ", addr);
+        }
+    }
+    fprintf(out, 
+        "\n        &&dispatch\n"
+        "    };\n"
+        "    uint32_t * r;\n"
+        "    int leave = 0;\n\n"
+        "    if(s == NULL){\n"
+        "        dpu_image_host = host;\n"
+        "        return AOT_EXIT;\n"
+        "    }\n"
+        "    r = s->regfile;\n\n"
+        "dispatch:\n"
+        "    if(leave){\n"
+        "        return leave & DEV_CODE ? AOT_SMC : AOT_EXIT;\n"
+        "    }\n"
+        "    if(s->flag_stop){\n"
+        "        return AOT_STOP;\n"
+        "    }\n"
+        "    switch(r[RF_PC]){\n");
+    for(addr = 0; addr < MEM_SIZE; addr++){
+        if(nodes[addr] == NODE_AOT){
+            fprintf(out, "        case 0x%04X: goto L_%04X;\n", addr, addr);
+        }
+    }
+    fprintf(out, "    }\n    return AOT_EXIT;\n");
+
+    /* One block of C per pair */
+    for(addr = 0; addr < MEM_SIZE; addr++){
+        if(nodes[addr] != NODE_AOT){
+            continue;
+        }
+        word = (uint32_t)mem[addr] << SHIFT_3BYTE | mem[addr + 1] << SHIFT_2BYTE
+            | mem[addr + 2] << SHIFT_BYTE | mem[addr + 3];
+        fprintf(out, "\nL_%04X:\n"
+            "    s->ir = 0x%08XU;\n"
+            "    s->mbr = s->ir;\n"
+            "    s->mar = 0x%04XU;\n"
+            "    r[RF_PC] = 0x%04XU;\n"
+            "    s->flag_ir = 1;\n",
+            addr, word, addr + REG_SIZE, addr + REG_SIZE);
+
+        flags = dpu_emitInst(out, word >> SHIFT_2BYTE, addr + REG_SIZE, 0, 0, nodes);
+        if(flags & EMIT_END){
+            continue;
+        }
+        fprintf(out, "    s->flag_ir = 0;\n");
+        flags |= dpu_emitInst(out, word & 0xFFFF, addr + REG_SIZE, 1, flags, nodes);
+        if(flags & EMIT_END){
+            continue;
+        }
+
+        /* Fall through to the next pair */
+        if(flags & EMIT_PC){
+            fprintf(out, "    goto dispatch;\n");
+            continue;
+        }
+        if(flags & EMIT_STORE){
+            fprintf(out, "    if(leave){\n        return leave & DEV_CODE ? AOT_SMC : AOT_EXIT;\n    }\n");
+        }
+        if(addr + REG_SIZE < MEM_SIZE && nodes[addr + REG_SIZE] == NODE_AOT){
+            fprintf(out, "    goto L_%04X;\n", addr + REG_SIZE);
+        }else{
+            fprintf(out, "    return AOT_EXIT;\n");
+        }
+    }
+    fprintf(out, "}\n");
+
+    fclose(out);
+    free(nodes);
+
+    printf("%u pairs have been translated to %s.\n", count, filename);
+
+    return 0;
 }
 
-/***************************************************************
- * Execute: Recognize instruction type, acknowledge instruction 
- *          fields, execute instruction based on instruction field values.
- *          Instruction field values are determined in the header.
- ******************************************************************/
-void dpu_execute(void * memory){
-    int i;
 
-    /* Recognize instruction type */
-    
-    /* 
-     * Data Processing 
-     */
+/********************************************************************
+ * Emit Instruction:  Write the C for one instruction of a translated
+ *                    pair, following dpu_execute().  next is the PC 
+ *                    after the pair is fetched, slot is 0 for IR0 and 1 
+ *                    for IR1, and flags holds what the pair has done so
+ *                    far.  Jumps go straight to their label unless the 
+ *                    PC was written or a store was made earlier in the
+ *                    pair, in which case they go through the dispatch.
+ *                    Returns the EMIT flags for the instruction.
+ ***********************************************************************/
+int dpu_emitInst(FILE * out, uint16_t inst, uint32_t next, int slot, int flags, const uint8_t * nodes){
+    uint16_t cir = inst;
+    uint32_t rd = RD, rn = RN, imm = IMM_VALUE, target;
+    const char * cond = NULL;
+    const char * op;
+    int i, emit = 0;
+
+    fprintf(out, "    s->cir = 0x%04X;\n    s->icount++;\n", inst);
+
     if(DATA_PROC){
-        /* Acknowledge Operation field */
-        if(DATA_AND){
-            alu = regfile[RD] & regfile[RN];
-            dpu_flags(alu);
-            regfile[RD] = alu;
-        }else if(DATA_EOR){
-            alu = regfile[RD] ^ regfile[RN];
-            dpu_flags(alu);
-            regfile[RD] = alu;
-        }else if(DATA_SUB){
-            alu = regfile[RD] + ~regfile[RN] + 1;
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], ~regfile[RN], 1);
-            regfile[RD] = alu;
-        }else if(DATA_SXB){
-            alu = regfile[RN];
-            if((alu & MSB8_MASK) == 1){
-                alu += SEX8TO32;
+        emit = rd == RF_PC ? EMIT_PC : 0;
+        if(DATA_AND || DATA_EOR || DATA_ORR || DATA_TST || DATA_TEQ){
+            op = (DATA_AND || DATA_TST) ? "&" : (DATA_ORR ? "|" : "^");
+            fprintf(out, "    s->alu = r[%u] %s r[%u];\n    FLAGS(s->alu);\n", rd, op, rn);
+            if(DATA_TST || DATA_TEQ){
+                emit = 0;
+            }else{
+                fprintf(out, "    r[%u] = s->alu;\n", rd);
             }
-            dpu_flags(alu);
-            regfile[RD] = alu;
+        }else if(DATA_SUB || DATA_CMP){
+            fprintf(out, "    s->alu = r[%u] + ~r[%u] + 1;\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], ~r[%u], 1);\n", rd, rn, rd, rn);
+            if(DATA_CMP){
+                emit = 0;
+            }else{
+                fprintf(out, "    r[%u] = s->alu;\n", rd);
+            }
+        }else if(DATA_SXB){
+            fprintf(out, "    s->alu = r[%u];\n    FLAGS(s->alu);\n    r[%u] = s->alu;\n", rn, rd);
         }else if(DATA_ADD){
-            alu = regfile[RD] + regfile[RN];
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], ~regfile[RN], 0);
-            regfile[RD] = alu;
+            fprintf(out, "    s->alu = r[%u] + r[%u];\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], ~r[%u], 0);\n    r[%u] = s->alu;\n", 
+                rd, rn, rd, rn, rd);
         }else if(DATA_ADC){
-            alu = regfile[RD] + regfile[RN] + flag_carry; 
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], regfile[RN], flag_carry);
-            regfile[RD] = alu;
-        }else if(DATA_LSR){
-            for(i = 0; i < regfile[RN]; i++){
-                flag_carry = regfile[RN] & LSB_MASK;
-                alu = regfile[RD] >> 1;
-            }
-            dpu_flags(alu);
-            regfile[RD] = alu;
-        }else if(DATA_LSL){
-            for(i = 0; i < regfile[RN]; i++){
-                flag_carry = regfile[RN] & LSB_MASK;
-                alu = regfile[RD] << 1;
-            }
-            dpu_flags(alu);
-            regfile[RD] = alu;
-        }else if(DATA_TST){
-            alu = regfile[RD] & regfile[RN];
-            dpu_flags(alu);
-        }else if(DATA_TEQ){
-            alu = regfile[RD] ^ regfile[RN];
-            dpu_flags(alu);
-        }else if(DATA_CMP){
-            alu = regfile[RD] + ~regfile[RN] + 1;
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], ~regfile[RN], 1);
+            fprintf(out, "    s->alu = r[%u] + r[%u] + s->flag_carry;\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], r[%u], s->flag_carry);\n    r[%u] = s->alu;\n", 
+                rd, rn, rd, rn, rd);
+        }else if(DATA_LSR || DATA_LSL){
+            fprintf(out, "    if(r[%u] != 0){\n        s->flag_carry = r[%u] & LSB_MASK;\n"
+                "        s->alu = r[%u] %s 1;\n    }\n    FLAGS(s->alu);\n    r[%u] = s->alu;\n",
+                rn, rn, rd, DATA_LSR ? ">>" : "<<", rd);
         }else if(DATA_ROR){
-            for(i = 0; i < regfile[RN]; i++){
-                flag_carry = regfile[RD] & LSB_MASK;
-                alu = regfile[RD] >> 1;
-                /* Set the MSB of the alu to the value shifted left */
-                if(flag_carry){
-                    alu |= MSB32_MASK;
-                }
-            }
-            dpu_flags(alu);
-            regfile[RD] = alu;
-        }else if(DATA_ORR){
-            alu = regfile[RD] | regfile[RN];
-            dpu_flags(alu);
-            regfile[RD] = alu;
+            fprintf(out, "    if(r[%u] != 0){\n        s->flag_carry = r[%u] & LSB_MASK;\n"
+                "        s->alu = (r[%u] >> 1) | (s->flag_carry ? MSB32_MASK : 0);\n    }\n"
+                "    FLAGS(s->alu);\n    r[%u] = s->alu;\n", rn, rd, rd, rd);
         }else if(DATA_MOV){
-            regfile[RD] = regfile[RN];
-            dpu_flags(regfile[RD]);
+            fprintf(out, "    r[%u] = r[%u];\n    FLAGS(r[%u]);\n", rd, rn, rd);
         }else if(DATA_BIC){
-            alu = regfile[RD] & ~regfile[RN];
-            dpu_flags(alu);
-            regfile[RD] = alu;
+            fprintf(out, "    s->alu = r[%u] & ~r[%u];\n    FLAGS(s->alu);\n    r[%u] = s->alu;\n", rd, rn, rd);
         }else if(DATA_MVN){
-            alu = ~regfile[RN];
-            dpu_flags(alu);
-            regfile[RD] = alu;
+            fprintf(out, "    s->alu = ~r[%u];\n    FLAGS(s->alu);\n    r[%u] = s->alu;\n", rn, rd);
         }
-    }
-    /* 
-     * Load/Store 
-     */
-    else if(LOAD_STORE){
-        /* MAR <- regfile[RN] */
-        
+    }else if(LOAD_STORE){
         if(LOAD_BIT){
-            /*Load Byte*/
+            fprintf(out, "    r[%u] = LOAD(r[%u]);\n", rd, rn);
             if(BYTE_BIT){
-                regfile[RD] = dpu_loadReg(regfile[RN], memory);
-                regfile[RD] = regfile[RD] & BYTE_MASK;
-            }
-            /*Load Double Word*/
-            else{
-                regfile[RD] = dpu_loadReg(regfile[RN], memory);
+                fprintf(out, "    r[%u] = r[%u] & BYTE_MASK;\n", rd, rd);
             }
+            emit = rd == RF_PC ? EMIT_PC : 0;
         }else{
-            mbr = regfile[RD];
-            /* Store one byte of the register into memory */
+            fprintf(out, "    s->mbr = r[%u];\n", rd);
             if(BYTE_BIT){
-                mar = regfile[RN];
-                mbr = regfile[RD];
-                *((unsigned char*)memory + mar) = (unsigned char)mbr & BYTE_MASK;
-            }
-            /*Store double word*/
-            else{
-                dpu_storeReg(regfile[RN], regfile[RD], memory);
+                fprintf(out, "    s->mar = r[%u];\n"
+                    "    if(DEV_HIT(s->mar)){\n"
+                    "        leave |= io->store(s, s->mar, s->mbr & BYTE_MASK, m);\n"
+                    "    }else if(s->mar >= MEM_SIZE){\n"
+                    "        s->flag_stop = 1;\n"
+                    "        s->fault = s->fault ? s->fault : FAULT_MEM;\n"
+                    "    }else{\n"
+                    "        if(code[s->mar >> PAGE_SHIFT]){\n            leave |= DEV_CODE;\n        }\n"
+                    "        m[s->mar] = s->mbr & BYTE_MASK;\n"
+                    "    }\n", rn);
+            }else{
+                fprintf(out, "    STORE(r[%u], r[%u]);\n", rn, rd);
             }
-        } 
-    /* 
-     * Immediate Operations 
-     */
+            emit = EMIT_STORE;
+        }
     }else if(IMMEDIATE){
-        /* Move immediate value into regfile at RD */
+        emit = rd == RF_PC ? EMIT_PC : 0;
         if(MOV){
-            regfile[RD] = IMM_VALUE;    
-            dpu_flags(regfile[RD]);
+            fprintf(out, "    r[%u] = 0x%02XU;\n    FLAGS(r[%u]);\n", rd, imm, rd);
         }else if(CMP){
-            alu = regfile[RD] + ~IMM_VALUE + 1;
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 0);
+            fprintf(out, "    s->alu = r[%u] + 0x%08XU + 1;\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], 0x%08XU, 0);\n", rd, ~imm, rd, ~imm);
+            emit = 0;
         }else if(ADD){
-            alu = regfile[RD] + IMM_VALUE;
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], IMM_VALUE, 0);
-            regfile[RD] = alu;
+            fprintf(out, "    s->alu = r[%u] + 0x%02XU;\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], 0x%02XU, 0);\n    r[%u] = s->alu;\n", 
+                rd, imm, rd, imm, rd);
         }else if(SUB){
-            alu = regfile[RD] + ~IMM_VALUE + 1;
-            dpu_flags(alu);
-            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 1);
-            regfile[RD] = alu;
-        }    
-    /* 
-     * Conditonal Branch 
-     */
+            fprintf(out, "    s->alu = r[%u] + 0x%08XU + 1;\n    FLAGS(s->alu);\n"
+                "    s->flag_carry = CARRY(r[%u], 0x%08XU, 1);\n    r[%u] = s->alu;\n", 
+                rd, ~imm, rd, ~imm, rd);
+        }
     }else if(COND_BRANCH){
-        /* Check condition codes and flags */
-        if(dpu_chkbra()){
-            /* Add relative address as a signed 8-bit */
-            alu = PC + (int8_t)COND_ADDR;
-
-            /* If IR1 is going to be executed next, the IR flag must be
-             * set to 0.  If this is not done, IR1's instruction will be
-             * executed as it has not been changed due to not fetching new 
-             * instructions right after changing the PC.  Also, if the IR flag is 
-             * high, then the PC was pointing to two instructions after the one 
-             * that is in IR0, being the branch that just executed. We now have to 
-             * decrement the ALU value by 2 to compensate for this before commiting
-             * to the PC.
-             */
-            if(flag_ir != 0){
-                flag_ir = 0;
-                alu = alu + ~THUMB_SIZE + 1;
-            }
-            PC = alu;
-        }        
-    /* 
-     * PUSH / PULL
-     */
+        if(EQ){
+            cond = "s->flag_zero";
+        }else if(NE){
+            cond = "s->flag_zero == 0";
+        }else if(CS){
+            cond = "s->flag_carry";
+        }else if(CC){
+            cond = "!s->flag_carry";
+        }else if(MI){
+            cond = "s->flag_sign";
+        }else if(PL){
+            cond = "!s->flag_sign";
+        }else if(HI){
+            cond = "s->flag_carry && s->flag_zero == 0";
+        }else if(LS){
+            cond = "s->flag_carry == 0 || s->flag_zero";
+        }else if(AL){
+            cond = "1";
+            emit = EMIT_END;
+        }
+        if(cond != NULL){
+            target = next + (int8_t)(COND_ADDR) - (slot == 0 ? THUMB_SIZE : 0);
+            fprintf(out, "    if(%s){\n        s->alu = r[RF_PC] + %d;\n", cond, (int8_t)(COND_ADDR));
+            if(slot == 0){
+                fprintf(out, "        s->flag_ir = 0;\n        s->alu = s->alu + ~THUMB_SIZE + 1;\n");
+            }
+            fprintf(out, "        r[RF_PC] = s->alu;\n");
+            if(flags & (EMIT_PC | EMIT_STORE) || target > MEM_SIZE - REG_SIZE || nodes[target] != NODE_AOT){
+                fprintf(out, "        goto dispatch;\n    }\n");
+            }else{
+                fprintf(out, "        goto L_%04X;\n    }\n", target);
+            }
+        }
     }else if(PUSH_PULL){
-        /* PULL */
         if(LOAD_BIT){
-            /* High Registers */
-            if(HIGH_BIT){
-                /* Registers 8 - 15 */
-                for(i = HI_REG; i < RF_SIZE; i++){
-                    /* Registers must be represented by what bit number
-                       they occupy.  HIGH reg's subtract half the list size.*/
-                    if(dpu_chkRList( i - HALF_RF )){
-                        /*If the current index is set on the register list: */
-
-                        /* Set MAR to be the stack pointer */
-                        regfile[i] = dpu_loadReg(SP & SP_MASK, memory);
-                        /* Post increment */
-                        alu = SP + REG_SIZE;
-                        SP = alu;
-                    }
+            for(i = 0; i < HALF_RF; i++){
+                if(REG_LIST & (1 << i)){
+                    fprintf(out, "    r[%u] = LOAD(r[RF_SP] & SP_MASK);\n"
+                        "    s->alu = r[RF_SP] + REG_SIZE;\n    r[RF_SP] = s->alu;\n",
+                        HIGH_BIT ? i + HI_REG : i);
                 }
             }
-            /* Low Registers */
-            else{
-                /* Registers 0 - 7 */
-                for(i = 0; i <= LOW_LIMIT; i++){
-                    if(dpu_chkRList(i)){
-                        regfile[i] = dpu_loadReg(SP & SP_MASK, memory);
-                        alu = SP + REG_SIZE;
-                        SP = alu;
-                    }
+            if(HIGH_BIT && (REG_LIST & R7)){
+                emit = EMIT_PC;
+            }
+            if(RET_BIT){
+                fprintf(out, "    r[RF_PC] = LOAD(r[RF_SP] & SP_MASK);\n"
+                    "    s->flag_ir = 0;\n"
+                    "    s->alu = r[RF_SP] + REG_SIZE;\n    r[RF_SP] = s->alu;\n"
+                    "    goto dispatch;\n");
+                emit = EMIT_END;
+            }
+        }else{
+            if(RET_BIT){
+                fprintf(out, "    s->alu = r[RF_SP] + ~REG_SIZE + 1;\n    r[RF_SP] = s->alu;\n"
+                    "    STORE(r[RF_SP] & SP_MASK, r[RF_LR]);\n");
+            }
+            for(i = HALF_RF - 1; i >= 0; i--){
+                if(REG_LIST & (1 << i)){
+                    fprintf(out, "    s->alu = r[RF_SP] + ~REG_SIZE + 1;\n    r[RF_SP] = s->alu;\n"
+                        "    STORE(r[RF_SP] & SP_MASK, r[%u]);\n", HIGH_BIT ? i + HI_REG : i);
                 }
             }
+            emit = EMIT_STORE;
+        }
+    }else if(BRANCH){
+        if(LINK_BIT){
+            fprintf(out, "    r[RF_LR] = r[RF_PC];\n");
+        }
+        target = OFFSET12;
+        fprintf(out, "    r[RF_PC] = 0x%04XU;\n    s->flag_ir = 0;\n", target);
+        if(flags & EMIT_STORE || target > MEM_SIZE - REG_SIZE || nodes[target] != NODE_AOT){
+            fprintf(out, "    goto dispatch;\n");
+        }else{
+            fprintf(out, "    goto L_%04X;\n", target);
+        }
+        emit = EMIT_END;
+    }else if(STOP){
+        fprintf(out, "    s->flag_stop = 1;\n    return leave & DEV_CODE ? AOT_SMC : AOT_STOP;\n");
+        emit = EMIT_END;
+    }
+
+    /* Memory accesses may fault */
+    if(((LOAD_STORE) || (PUSH_PULL)) && !(emit & EMIT_END)){
+        fprintf(out, "    if(s->flag_stop){\n        return leave & DEV_CODE ? AOT_SMC : AOT_STOP;\n    }\n");
+    }
+
+    return emit;
+}
+
+
+/********************************************************************
+ * Attach:  Load a translated image built as a shared object.  It is 
+ *          used by 'g' whenever memory still holds the words it was 
+ *          translated from.  The image attached before is kept unless
+ *          the new one is found whole and built for this DPU.
+ ***********************************************************************/
+int dpu_attach(void * memory){
+    unsigned char filename[BUFF_SIZE];
+    const unsigned int * count;
+    const uint32_t * abi;
+    const uint32_t * addr;
+    const uint32_t * words;
+    const void * const * const * host;
+    int (*image)(struct dpu_state *, unsigned char *, const uint8_t *, const struct dpu_io *);
+    unsigned int i;
+    void * handle;
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+
+    /* dlopen() needs a path to look outside the library path */
+    if((handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL)) == NULL){
+        printf("attach: %s\n", dlerror());
+        return -1;
+    }
+    if((count = dlsym(handle, AOT_COUNT)) == NULL 
+            || (addr = dlsym(handle, AOT_ADDR)) == NULL
+            || (words = dlsym(handle, AOT_IR)) == NULL
+            || (*(void **)&image = dlsym(handle, AOT_SYMBOL)) == NULL){
+        printf("attach: %s is not a translated image.\n", filename);
+        dlclose(handle);
+        return -1;
+    }
+    if((abi = dlsym(handle, AOT_STATE)) == NULL || *abi != AOT_ABI){
+        printf("attach: %s was built for another version of the DPU; translate it again.\n", filename);
+        dlclose(handle);
+        return -1;
+    }
+    if(aot_map == NULL && (aot_map = malloc(MEM_SIZE)) == NULL){
+        perror("attach: malloc");
+        dlclose(handle);
+        return -1;
+    }
+
+    if(aot_handle != NULL){
+        dlclose(aot_handle);
+    }
+    aot_handle = handle;
+    aot_image = image;
+    aot_addr = addr;
+    aot_ir = words;
+    aot_count = *count;
+
+    /* Images translated before the host table was added have none */
+    aot_host = NULL;
+    if((host = dlsym(handle, AOT_HOST)) != NULL){
+        aot_image(NULL, NULL, NULL, NULL);
+        aot_host = *host;
+    }
+    dpu_jitWrite();
+
+    memset(aot_map, 0, MEM_SIZE);
+    memset(aot_pages, 0, CODE_PAGES);
+    for(i = 0; i < aot_count; i++){
+        aot_map[aot_addr[i]] = 1;
+        aot_pages[aot_addr[i] >> PAGE_SHIFT] = 1;
+        aot_pages[(aot_addr[i] + REG_SIZE - 1) >> PAGE_SHIFT] = 1;
+    }
+
+    printf("%u translated pairs attached", aot_count);
+    if(!dpu_aotCheck(memory)){
+        printf(", but they do not match memory");
+    }
+    printf(".\n");
+
+    return 0;
+}
+
+
+/********************************************************************
+ * AOT Check:  Returns 1 if memory holds the words the attached image
+ *             was translated from.  The pages of translated code are 
+ *             given empty decoded pages, so that stores into them are 
+ *             caught by the same check that catches stores into blocks.
+ ***********************************************************************/
+int dpu_aotCheck(void * memory){
+    unsigned char * mem = memory;
+    unsigned int i;
+    uint32_t addr, word;
+
+    for(i = 0; i < aot_count; i++){
+        addr = aot_addr[i];
+        word = (uint32_t)mem[addr] << SHIFT_3BYTE | mem[addr + 1] << SHIFT_2BYTE
+            | mem[addr + 2] << SHIFT_BYTE | mem[addr + 3];
+        if(word != aot_ir[i]){
+            return 0;
+        }
+    }
+
+    for(i = 0; i < CODE_PAGES; i++){
+        if(aot_pages[i] && code_pages[i] == NULL && (code_pages[i] = calloc(1, sizeof(struct dpu_page))) != NULL){
+            code_pages[i]->lo = i << PAGE_SHIFT;
+            code_pages[i]->hi = (i + 1) << PAGE_SHIFT;
+            memcpy(code_pages[i]->copy, mem + code_pages[i]->lo, CODE_PAGE);
+        }
+    }
+
+    return 1;
+}
+
+
+/********************************************************************
+ * AOT:  Run the attached image from the current state.  A store into 
+ *       code leaves the translation stale, so it is not used again 
+ *       until the next run finds memory matching it.
+ ***********************************************************************/
+void dpu_aot(void * memory){
+    struct dpu_io io = {dpu_aotLoad, dpu_aotStore};
+    struct dpu_state state;
+    uint8_t code[CODE_PAGES];
+    unsigned int i;
+
+    for(i = 0; i < CODE_PAGES; i++){
+        code[i] = code_pages[i] != NULL;
+    }
+
+    dpu_save(&state);
+    sample_state = &state;
+    if(aot_image(&state, memory, code, &io) == AOT_SMC){
+        aot_valid = 0;
+        dpu_flush();
+    }
+    sample_state = NULL;
+    dpu_restore(&state);
+}
+
+
+/********************************************************************
+ * Jit Set:  Start or stop writing a jitdump for perf.  The pairs of a
+ *           translated image, attached now or later, are written to it
+ *           as pieces of code named by their guest address.  The dump 
+ *           is mapped executable once, which is how perf record learns
+ *           of it; after perf inject --jit, host samples in translated
+ *           code are named by the pair they fell in.  The records are
+ *           stamped with CLOCK_MONOTONIC, so record with -k mono.
+ ***********************************************************************/
+int dpu_jitSet(){
+    struct dpu_jitHeader header;
+    struct timespec now;
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE + 0x20];
+    const ElfW(Ehdr) * elf;
+    Dl_info info;
+
+    if(jit_file != NULL){
+        munmap(jit_marker, sysconf(_SC_PAGESIZE));
+        fclose(jit_file);
+        jit_file = NULL;
+        printf("Jitdump stopped.\n");
+        return 0;
+    }
+
+    sprintf(filename, JIT_NAME, (int)getpid());
+    if((jit_file = fopen(filename, "w+b")) == NULL){
+        snprintf(error, sizeof(error), "jitdump: fopen: %s", filename);
+        perror(error);
+        return -1;
+    }
+
+    /* The machine is the one this program was built for */
+    memset(&header, 0, sizeof(header));
+    if(dladdr((void *)dpu_jitSet, &info) != 0){
+        elf = info.dli_fbase;
+        header.mach = elf->e_machine;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    header.magic = JIT_MAGIC;
+    header.version = JIT_VERSION;
+    header.size = sizeof(header);
+    header.pid = getpid();
+    header.timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    if(fwrite(&header, sizeof(header), 1, jit_file) != 1 || fflush(jit_file) == EOF){
+        perror("jitdump: fwrite");
+        fclose(jit_file);
+        jit_file = NULL;
+        return -1;
+    }
+    jit_marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(jit_file), 0);
+    if(jit_marker == MAP_FAILED){
+        perror("jitdump: mmap");
+        fclose(jit_file);
+        jit_file = NULL;
+        return -1;
+    }
+
+    printf("Writing a jitdump to %s.\n", filename);
+    dpu_jitWrite();
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Jit Write:  Write the pairs of the attached image to the jitdump, if
+ *             one is being written.  Each pair runs from where its code
+ *             begins to where the next begins in the host, or the end of
+ *             the image function.  Code the compiler moved out of the 
+ *             function is left unnamed.
+ ***********************************************************************/
+int dpu_jitWrite(){
+    struct dpu_jitLoad load;
+    struct timespec now;
+    unsigned char name[BUFF_SIZE];
+    const ElfW(Sym) * sym;
+    Dl_info info;
+    uintptr_t start, end, from, to;
+    unsigned int * order;
+    unsigned int i, k;
+
+    if(jit_file == NULL || aot_image == NULL || aot_host == NULL){
+        return 0;
+    }
+    if(dladdr1(*(void **)&aot_image, &info, (void **)&sym, RTLD_DL_SYMENT) == 0 || sym == NULL){
+        printf("jitdump: the image function cannot be found.\n");
+        return -1;
+    }
+    start = (uintptr_t)info.dli_saddr;
+    end = start + sym->st_size;
+
+    if((order = malloc((aot_count + 1) * sizeof(unsigned int))) == NULL){
+        perror("jitdump: malloc");
+        return -1;
+    }
+    for(i = 0; i <= aot_count; i++){
+        order[i] = i;
+    }
+    qsort(order, aot_count + 1, sizeof(unsigned int), dpu_hostOrder);
+
+    memset(&load, 0, sizeof(load));
+    load.id = JIT_LOAD;
+    load.pid = getpid();
+    load.tid = load.pid;
+    for(k = 0; k <= aot_count; k++){
+        i = order[k];
+        from = (uintptr_t)aot_host[i];
+        to = k < aot_count ? (uintptr_t)aot_host[order[k + 1]] : end;
+        if(from < start || from >= end || to <= from){
+            continue;
+        }
+        if(to > end){
+            to = end;
+        }
+        if(i < aot_count){
+            sprintf(name, "dpu_pair_%04X", aot_addr[i]);
+        }else{
+            strcpy(name, "dpu_dispatch");
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        load.timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        load.vma = from;
+        load.addr = from;
+        load.length = to - from;
+        load.index = jit_index++;
+        load.size = sizeof(load) + strlen(name) + 1 + load.length;
+        if(fwrite(&load, sizeof(load), 1, jit_file) != 1
+                || fwrite(name, strlen(name) + 1, 1, jit_file) != 1
+                || fwrite((const void *)from, load.length, 1, jit_file) != 1){
+            perror("jitdump: fwrite");
+            break;
+        }
+    }
+    fflush(jit_file);
+    free(order);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Host Order:  Order indexes into aot_host by the address they hold.
+ ***********************************************************************/
+int dpu_hostOrder(const void * a, const void * b){
+    uintptr_t x = (uintptr_t)aot_host[*(const unsigned int *)a];
+    uintptr_t y = (uintptr_t)aot_host[*(const unsigned int *)b];
+
+    return x < y ? -1 : x > y;
+}
+
+
+/********************************************************************
+ * Fault:  Stop the program for reason.  The first fault is kept.
+ ***********************************************************************/
+void dpu_fault(uint8_t reason){
+    flag_stop = 1;
+    if(fault == FAULT_NONE){
+        counts.faults[reason]++;
+        fault = reason;
+    }
+}
+
+
+/********************************************************************
+ * Atomic:  Execute an extended instruction on the word at regfile[RN],
+ *          which must be word aligned.  The word is read and written 
+ *          with one atomic host operation, so other cores never see it
+ *          half done.  Extended op codes with no instruction do nothing.
+ *
+ *          SWP - Exchange RD with the word.
+ *          LDX - Load the word into RD, and reserve it.
+ *          STX - Store RD into the word if it is reserved and still 
+ *                holds the value LDX loaded.  The zero flag is set if 
+ *                the store was made, and cleared if not.  Either way 
+ *                the reservation is cleared.
+ ***********************************************************************/
+void dpu_atomic(void * memory){
+    uint32_t * word;
+    uint32_t expected;
+
+    if(!(EXT_SWP) && !(EXT_LDX) && !(EXT_STX)){
+        return;
+    }
+
+    mar = regfile[RN];
+    if(mmu_on){
+        mar = EXT_LDX ? MMU_MAP(mar, tlb_read, MMU_READ, memory) : MMU_MAP(mar, tlb_write, MMU_WRITE, memory);
+    }
+    if(mar > MEM_SIZE - CYCLES){
+        dpu_fault(FAULT_MEM);
+        return;
+    }
+    if(mar & (REG_SIZE - 1)){
+        dpu_fault(FAULT_ALIGN);
+        return;
+    }
+    word = (uint32_t *)((unsigned char *)memory + mar);
+
+    if(EXT_LDX){
+        mbr = GUEST_WORD(__atomic_load_n(word, __ATOMIC_SEQ_CST));
+        regfile[RD] = mbr;
+        reserved = 1;
+        reserve_addr = mar;
+        reserve_value = mbr;
+        return;
+    }
+
+    /* An aligned word lies in one code page */
+    if(CODE_HIT(mar, CYCLES)){
+        dpu_invalidate(mar);
+    }
+
+    if(EXT_SWP){
+        mbr = GUEST_WORD(__atomic_exchange_n(word, GUEST_WORD(regfile[RD]), __ATOMIC_SEQ_CST));
+        regfile[RD] = mbr;
+    }else{
+        mbr = regfile[RD];
+        expected = GUEST_WORD(reserve_value);
+        flag_zero = reserved && reserve_addr == mar
+            && __atomic_compare_exchange_n(word, &expected, GUEST_WORD(mbr), 0, 
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        reserved = 0;
+    }
+    if(SHARED_HIT(mar, CYCLES)){
+        dpu_announce();
+    }
+}
+
+
+/********************************************************************
+ * Bulk:  Execute a block move or fill of regfile[0] bytes, at host 
+ *        memmove and memset speed.  The bytes written are checked for 
+ *        decoded code and shared pages as any store is.  With the MMU
+ *        on, the work is split at page boundaries and each part mapped 
+ *        on its own.  A copy to higher addresses over its own source 
+ *        then takes the parts from the end back, so that none is written
+ *        before it is read.  The registers are left past the bytes done,
+ *        with the bytes still to do in regfile[0], so a fault part way 
+ *        shows how far it got; a copy taken from the end leaves them 
+ *        where they began until it is done.
+ *
+ *        CPY - Copy the bytes at regfile[RN] to regfile[RD], as memmove
+ *              does if the two overlap.
+ *        FIL - Fill the bytes at regfile[RD] with the low byte of RN.
+ ***********************************************************************/
+void dpu_bulk(void * memory){
+    unsigned char * mem = memory;
+    uint32_t length = regfile[0];
+    uint32_t to = regfile[RD];
+    uint32_t from = regfile[RN];
+    uint32_t chunk, dst, src, addr, end;
+    uint8_t copy = EXT_CPY;
+    uint8_t fill = regfile[RN] & BYTE_MASK;
+    uint8_t back = copy && mmu_on && to > from && to - from < length;
+
+    while(length > 0){
+        chunk = length;
+        dst = back ? to + length : to;
+        src = back ? from + length : from;
+        if(mmu_on && back){
+            if(chunk > ((dst - 1) & (MMU_PAGE - 1)) + 1){
+                chunk = ((dst - 1) & (MMU_PAGE - 1)) + 1;
+            }
+            if(chunk > ((src - 1) & (MMU_PAGE - 1)) + 1){
+                chunk = ((src - 1) & (MMU_PAGE - 1)) + 1;
+            }
+            dst -= chunk;
+            src -= chunk;
+        }else if(mmu_on){
+            if(chunk > MMU_PAGE - (to & (MMU_PAGE - 1))){
+                chunk = MMU_PAGE - (to & (MMU_PAGE - 1));
+            }
+            if(copy && chunk > MMU_PAGE - (from & (MMU_PAGE - 1))){
+                chunk = MMU_PAGE - (from & (MMU_PAGE - 1));
+            }
+        }
+        if(mmu_on){
+            dst = MMU_MAP(dst, tlb_write, MMU_WRITE, memory);
+            if(copy && !flag_stop){
+                src = MMU_MAP(src, tlb_read, MMU_READ, memory);
+            }
+            if(flag_stop){
+                break;
+            }
+        }
+        if(dst > MEM_SIZE || chunk > MEM_SIZE - dst){
+            mar = dst;
+            dpu_fault(FAULT_MEM);
+            break;
+        }
+        if(copy && (src > MEM_SIZE || chunk > MEM_SIZE - src)){
+            mar = src;
+            dpu_fault(FAULT_MEM);
+            break;
+        }
+
+        /* Drop any decoded blocks written over, a code page at a time */
+        for(addr = dst; addr < dst + chunk; addr = end){
+            end = (addr | PAGE_MASK) + 1 < dst + chunk ? (addr | PAGE_MASK) + 1 : dst + chunk;
+            if(CODE_HIT(addr, end - addr)){
+                dpu_invalidate(addr);
+            }
+        }
+
+        if(copy){
+            memmove(mem + dst, mem + src, chunk);
+        }else{
+            memset(mem + dst, fill, chunk);
+        }
+        dpu_announceOver(dst, chunk);
+        mar = dst + chunk;
+        length -= chunk;
+        if(!back){
+            to += chunk;
+            from += chunk;
+        }else if(length == 0){
+            to += regfile[0];
+            from += regfile[0];
+        }
+    }
+
+    regfile[RD] = to;
+    if(copy){
+        regfile[RN] = from;
+    }
+    regfile[0] = length;
+}
+
+
+/********************************************************************
+ * Bulk Note:  Note the bytes a block move or fill is about to read and
+ *             write for the cache model, in pieces an access can hold.
+ ***********************************************************************/
+void dpu_bulkNote(){
+    uint32_t done, piece;
+
+    for(done = 0; done < regfile[0] && done < MEM_SIZE; done += piece){
+        piece = regfile[0] - done < CACHE_PIECE ? regfile[0] - done : CACHE_PIECE;
+        if(EXT_CPY){
+            CACHE_NOTE(cache_pc, regfile[RN] + done, ACCESS_LOAD, piece);
+        }
+        CACHE_NOTE(cache_pc, regfile[RD] + done, ACCESS_STORE, piece);
+    }
+}
+
+
+/********************************************************************
+ * Announce:  Tell the other cores that code they may have decoded has 
+ *            been written over.
+ ***********************************************************************/
+void dpu_announce(){
+    __atomic_fetch_add(&code_epoch, 1, __ATOMIC_RELEASE);
+}
+
+
+/********************************************************************
+ * Announce Over:  Announce length bytes written from addr, once they 
+ *                 are written, if any core decoded code from them.
+ ***********************************************************************/
+void dpu_announceOver(uint32_t addr, uint32_t length){
+    uint32_t page, from, to, end = addr + length;
+
+    for(page = addr & ~PAGE_MASK; page < end; page += CODE_PAGE){
+        from = page < addr ? addr : page;
+        to = page + CODE_PAGE < end ? page + CODE_PAGE : end;
+        if(SHARED_HIT(from, to - from)){
+            dpu_announce();
+            return;
+        }
+    }
+}
+
+
+/********************************************************************
+ * Claim:  Claim the bytes a block was just decoded from in code_shared,
+ *         then check them again.  Returns 0 if another core has stored
+ *         into them meanwhile, or into any code since this core last 
+ *         threw its blocks away, as the block may then be stale.
+ ***********************************************************************/
+int dpu_claim(const struct dpu_block * block, const unsigned char * memory){
+    struct dpu_span * span = &code_shared[block->start >> PAGE_SHIFT];
+    uint32_t end = block->start + block->words * REG_SIZE;
+    uint32_t lo = __atomic_load_n(&span->lo, __ATOMIC_RELAXED);
+    uint32_t hi = __atomic_load_n(&span->hi, __ATOMIC_RELAXED);
+    uint32_t addr, word;
+    unsigned int i;
+
+    /* A failed exchange reloads lo or hi */
+    while(block->start < lo && !__atomic_compare_exchange_n(&span->lo, &lo, block->start, 1, 
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    while(end > hi && !__atomic_compare_exchange_n(&span->hi, &hi, end, 1, 
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for(i = 0; i < block->words; i++){
+        addr = block->start + i * REG_SIZE;
+        word = (uint32_t)memory[addr] << SHIFT_3BYTE | memory[addr + 1] << SHIFT_2BYTE
+            | memory[addr + 2] << SHIFT_BYTE | memory[addr + 3];
+        if(word != block->ir[i]){
+            return 0;
+        }
+    }
+
+    return core_epoch == __atomic_load_n(&code_epoch, __ATOMIC_ACQUIRE);
+}
+
+
+/********************************************************************
+ * SMP:  Run the program on several cores at once, each on its own 
+ *       thread, all sharing memory.  Every core begins as a copy of the
+ *       processor, with its core number in a chosen register so that 
+ *       each can take its own share of the work.  Once all cores have
+ *       stopped, each core's registers are shown.  The processor's own 
+ *       registers are left as they were.
+ ***********************************************************************/
+int dpu_smp(void * memory){
+    pthread_t threads[MAX_CORES];
+    struct dpu_core cores[MAX_CORES];
+    struct dpu_state saved;
+    unsigned char flush[BUFF_SIZE];
+    unsigned int count, seed, c;
+    int err;
+
+    printf("Enter number of cores (1-%d):\t", MAX_CORES);
+    if(scanf("%u", &count) == 0 || count == 0 || count > MAX_CORES){
+        printf("Not a valid number of cores.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    printf("Enter register to seed with core number in hex:\t");
+    if(scanf("%x", &seed) == 0 || seed >= RF_SIZE){
+        printf("Not a valid register.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    dpu_save(&saved);
+    for(c = 0; c < CODE_PAGES; c++){
+        code_shared[c].lo = MAX32;
+        code_shared[c].hi = 0;
+    }
+    smp_cores = count;
+
+    for(c = 0; c < count; c++){
+        cores[c].state = saved;
+        cores[c].state.regfile[seed] = c;
+        cores[c].memory = memory;
+        memset(&cores[c].metrics, 0, sizeof(cores[c].metrics));
+    }
+    dpu_enroll(CENSUS_CORES, "core", &cores[0].metrics, sizeof(struct dpu_core), count);
+    for(c = 0; c < count; c++){
+        if((err = pthread_create(&threads[c], NULL, dpu_core, &cores[c])) != 0){
+            printf("smp: pthread_create: %s\n", strerror(err));
+            break;
+        }
+    }
+    count = c;
+    for(c = 0; c < count; c++){
+        pthread_join(threads[c], NULL);
+    }
+    smp_cores = 0;
+    dpu_enroll(CENSUS_CORES, NULL, NULL, 0, 0);
+
+    /* The cores changed memory behind the processor's back */
+    dpu_flush();
+    dpu_recordEvent(EV_MEMORY, 0, MEM_SIZE, memory);
+
+    for(c = 0; c < count; c++){
+        printf("\nCore %d:", c);
+        dpu_restore(&cores[c].state);
+        dpu_reg();
+    }
+    dpu_restore(&saved);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Core:  Thread body of one core of a multi-core run.  arg is the 
+ *        core's dpu_core, whose state is loaded, run until it stops, 
+ *        and saved back.
+ ***********************************************************************/
+void * dpu_core(void * arg){
+    struct dpu_core * core = arg;
+
+    code_common = 1;
+    dpu_restore(&core->state);
+    dpu_tallyTo(&core->metrics);
+    core_epoch = __atomic_load_n(&code_epoch, __ATOMIC_ACQUIRE);
+    dpu_run(core->memory, NO_LIMIT, 0);
+    dpu_save(&core->state);
+    dpu_flush();
+
+    return NULL;
+}
+
+
+/********************************************************************
+ * Sched:  Run many guests over a pool of threads.  Every guest begins
+ *         as a copy of the processor and memory, with its guest number
+ *         in a chosen register.  The threads take guests from the run 
+ *         queue in turn, running each for a quantum of instructions, 
+ *         until all have stopped.  A line is shown for each guest.  The
+ *         processor and memory are left as they were.
+ ***********************************************************************/
+int dpu_sched(void * memory){
+    struct dpu_sched sched;
+    struct dpu_state saved;
+    struct timespec begin, end;
+    pthread_t threads[MAX_CORES];
+    unsigned char flush[BUFF_SIZE];
+    unsigned int count, nthreads, seed, g, t;
+    unsigned long long quantum;
+    uint64_t total = 0;
+    double secs;
+    int err;
+
+    printf("Enter number of guests (1-%d):\t", MAX_GUESTS);
+    if(scanf("%u", &count) == 0 || count == 0 || count > MAX_GUESTS){
+        printf("Not a valid number of guests.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter number of threads (1-%d):\t", MAX_CORES);
+    if(scanf("%u", &nthreads) == 0 || nthreads == 0 || nthreads > MAX_CORES){
+        printf("Not a valid number of threads.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter quantum in instructions:\t");
+    if(scanf("%llu", &quantum) == 0 || quantum == 0){
+        printf("Not a valid quantum.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter register to seed with guest number in hex:\t");
+    if(scanf("%x", &seed) == 0 || seed >= RF_SIZE){
+        printf("Not a valid register.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    if(dpu_resultOpen(&sched) != 0){
+        return -1;
+    }
+
+    /* Each thread's rows are had before any runs, so none are lost */
+    sched.guests = aligned_alloc(CACHE_LINE, count * sizeof(struct dpu_guest));
+    sched.queue = malloc(count * sizeof(uint32_t));
+    sched.rows = sched.results >= 0 ? malloc(nthreads * sizeof(struct dpu_results)) : NULL;
+    if(sched.guests == NULL || sched.queue == NULL || (sched.results >= 0 && sched.rows == NULL)){
+        perror("sched: malloc");
+        free(sched.guests);
+        free(sched.queue);
+        free(sched.rows);
+        if(sched.results >= 0){
+            close(sched.results);
+        }
+        return -1;
+    }
+
+    /* Every guest is queued, but given no memory yet */
+    dpu_save(&saved);
+    for(g = 0; g < count; g++){
+        sched.guests[g].state = saved;
+        sched.guests[g].state.regfile[seed] = g;
+        sched.guests[g].memory = NULL;
+        memset(&sched.guests[g].metrics, 0, sizeof(sched.guests[g].metrics));
+        sched.queue[g] = g;
+    }
+    dpu_enroll(CENSUS_GUESTS, "guest", &sched.guests[0].metrics, sizeof(struct dpu_guest), count);
+    sched.count = count;
+    sched.quantum = quantum;
+    sched.head = 0;
+    sched.queued = count;
+    sched.live = count;
+    sched.image = memory;
+    sched.start = saved.icount;
+    sched.workers = 0;
+    sched.lost = 0;
+    for(t = 0; sched.rows != NULL && t < nthreads; t++){
+        sched.rows[t].rows = 0;
+    }
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_cond_init(&sched.wake, NULL);
+    pages_made = 0;
+    pages_joined = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for(t = 0; t < nthreads; t++){
+        if((err = pthread_create(&threads[t], NULL, dpu_worker, &sched)) != 0){
+            printf("sched: pthread_create: %s\n", strerror(err));
+            break;
+        }
+    }
+    nthreads = t;
+    /* With no thread to run them, the guests are left where they are */
+    if(nthreads == 0){
+        sched.live = 0;
+    }
+    for(t = 0; t < nthreads; t++){
+        pthread_join(threads[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    dpu_enroll(CENSUS_GUESTS, NULL, NULL, 0, 0);
+
+    for(g = 0; g < count; g++){
+        total += sched.guests[g].state.icount - saved.icount;
+        free(sched.guests[g].memory);
+        /* With a results file, the lines would only slow a batch down */
+        if(sched.results >= 0){
+            continue;
+        }
+        printf("Guest %u: PC:%08X r00:%08X %llu instructions", g, sched.guests[g].state.regfile[RF_PC],
+            sched.guests[g].state.regfile[0], (unsigned long long)(sched.guests[g].state.icount - saved.icount));
+        if(sched.guests[g].state.fault != FAULT_NONE){
+            printf(", fault %u at %08X", sched.guests[g].state.fault, sched.guests[g].state.mar);
+        }
+        printf("\n");
+    }
+    secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%u guests ran %llu instructions in %.2fs (%.0f/s) on %u threads.\n",
+        count, (unsigned long long)total, secs, secs > 0 ? total / secs : 0.0, nthreads);
+    printf("%u code pages decoded, %u taken from the cache.\n", pages_made, pages_joined);
+    if(sched.lost > 0){
+        printf("%u guests were left out of the results file by short writes.\n", sched.lost);
+    }
+    if(sched.results >= 0 && close(sched.results) != 0){
+        perror("results: close");
+    }
+
+    pthread_mutex_destroy(&sched.lock);
+    pthread_cond_destroy(&sched.wake);
+    free(sched.guests);
+    free(sched.queue);
+    free(sched.rows);
+    dpu_restore(&saved);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Worker:  Thread body of the scheduler.  arg is the dpu_sched.  A 
+ *          guest is taken from the front of the queue, run for a 
+ *          quantum, and put back at the end unless it stopped.  The 
+ *          thread's decoded blocks are kept from guest to guest, minus
+ *          any pages whose code differs in the next guest.  Guests that
+ *          stop are gathered into the thread's own rows for the results
+ *          file, if there is one, which dpu_sched() set aside for it.
+ *          The thread leaves once no guest is left running.
+ ***********************************************************************/
+void * dpu_worker(void * arg){
+    struct dpu_sched * sched = arg;
+    struct dpu_guest * guest;
+    struct dpu_results * rows = NULL;
+    uint32_t g;
+
+    code_common = 1;
+    pthread_mutex_lock(&sched->lock);
+    if(sched->rows != NULL){
+        rows = &sched->rows[sched->workers++];
+    }
+    forever{
+        while(sched->queued == 0 && sched->live > 0){
+            pthread_cond_wait(&sched->wake, &sched->lock);
+        }
+        if(sched->queued == 0){
+            break;
+        }
+        g = sched->queue[sched->head];
+        sched->head = (sched->head + 1) % sched->count;
+        sched->queued--;
+        pthread_mutex_unlock(&sched->lock);
+
+        guest = &sched->guests[g];
+        if(guest->memory == NULL){
+            if((guest->memory = malloc(MEM_SIZE)) != NULL){
+                memcpy(guest->memory, sched->image, MEM_SIZE);
+            }else{
+                perror("sched: malloc");
+                guest->state.flag_stop = 1;
+            }
+        }
+        if(guest->memory != NULL){
+            dpu_rebase(guest->memory);
+            dpu_restore(&guest->state);
+            dpu_tallyTo(&guest->metrics);
+            dpu_run(guest->memory, icount + sched->quantum, 0);
+            dpu_save(&guest->state);
+        }
+        if(rows != NULL && guest->state.flag_stop){
+            dpu_resultAdd(sched, rows, g, guest);
+        }
+
+        pthread_mutex_lock(&sched->lock);
+        if(guest->state.flag_stop){
+            if(--sched->live == 0){
+                pthread_cond_broadcast(&sched->wake);
+            }
+        }else{
+            sched->queue[(sched->head + sched->queued) % sched->count] = g;
+            sched->queued++;
+            pthread_cond_signal(&sched->wake);
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    if(rows != NULL){
+        dpu_resultWrite(sched, rows);
+    }
+    dpu_flush();
+
+    return NULL;
+}
+
+
+/********************************************************************
+ * Result Open:  Ask for a results file and the regions of memory to 
+ *               hash, then start the file with its head, open to be 
+ *               appended to.  A blank filename leaves sched->results at
+ *               -1.  Returns -1 if the file cannot be written.
+ ***********************************************************************/
+int dpu_resultOpen(struct dpu_sched * sched){
+    struct dpu_resultHead * head = &sched->layout;
+    unsigned char filename[BUFF_SIZE];
+    unsigned char line[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    unsigned int offset, length;
+    int used, at = 0;
+
+    sched->results = -1;
+    printf("\nEnter a results file (blank for none): ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+    if(filename[0] == '\0'){
+        return 0;
+    }
+
+    memset(head, 0, sizeof(struct dpu_resultHead));
+    head->magic = RESULT_MAGIC;
+    printf("Enter up to %d regions to hash, each an offset and length in hex:\t", RESULT_REGIONS);
+    fgets(line, BUFF_SIZE, stdin);
+    while(head->regions < RESULT_REGIONS && sscanf(line + at, "%x %x%n", &offset, &length, &used) == 2){
+        if(offset >= MEM_SIZE || length > MEM_SIZE - offset){
+            printf("Not a valid region.\n");
+            return -1;
+        }
+        head->offset[head->regions] = offset;
+        head->length[head->regions++] = length;
+        at += used;
+    }
+
+    if((sched->results = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0){
+        sprintf(error, "results: open: %s", filename);
+        perror(error);
+        return -1;
+    }
+    if(write(sched->results, head, sizeof(struct dpu_resultHead)) != sizeof(struct dpu_resultHead)){
+        perror("results: write");
+        close(sched->results);
+        sched->results = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Result Add:  Add how guest number id ended to the rows, writing them
+ *              out as a group once there are RESULT_ROWS of them.
+ ***********************************************************************/
+void dpu_resultAdd(struct dpu_sched * sched, struct dpu_results * rows, uint32_t id, const struct dpu_guest * guest){
+    const struct dpu_state * state = &guest->state;
+    unsigned int row = rows->rows++;
+    unsigned int i;
+
+    rows->icount[row] = state->icount - sched->start;
+    for(i = 0; i < sched->layout.regions; i++){
+        rows->hash[i][row] = guest->memory == NULL ? 0
+            : dpu_hash(guest->memory + sched->layout.offset[i], sched->layout.length[i]);
+    }
+    rows->id[row] = id;
+    for(i = 0; i < RF_SIZE; i++){
+        rows->regfile[i][row] = state->regfile[i];
+    }
+    rows->flags[row] = (state->flag_sign ? RESULT_SIGN : 0) | (state->flag_zero ? RESULT_ZERO : 0)
+        | (state->flag_carry ? RESULT_CARRY : 0);
+    rows->fault[row] = state->fault;
+
+    if(rows->rows == RESULT_ROWS){
+        dpu_resultWrite(sched, rows);
+    }
+}
+
+
+/********************************************************************
+ * Result Write:  Append the rows gathered to the results file as one
+ *                group, its columns gathered by a single writev() so 
+ *                that groups from other threads cannot come between 
+ *                them, and start the rows over.  Returns -1 if the 
+ *                group could not be written whole, counting its rows as
+ *                lost.
+ ***********************************************************************/
+int dpu_resultWrite(struct dpu_sched * sched, struct dpu_results * rows){
+    static const uint8_t pad[RESULT_ALIGN];
+    struct dpu_resultGroup group;
+    struct iovec parts[RESULT_REGIONS + RF_SIZE + 6];
+    unsigned int n = rows->rows;
+    unsigned int count = 0;
+    unsigned int i;
+    size_t size;
+    ssize_t written;
+
+    if(n == 0){
+        return 0;
+    }
+    rows->rows = 0;
+
+    size = sizeof(group) + n * ((1 + sched->layout.regions) * sizeof(uint64_t) 
+        + (1 + RF_SIZE) * sizeof(uint32_t) + 2 * sizeof(uint8_t));
+    group.magic = RESULT_GROUP;
+    group.rows = n;
+    group.regions = sched->layout.regions;
+    group.size = (size + RESULT_ALIGN - 1) & ~(RESULT_ALIGN - 1);
+
+    parts[count++] = (struct iovec){&group, sizeof(group)};
+    parts[count++] = (struct iovec){rows->icount, n * sizeof(uint64_t)};
+    for(i = 0; i < sched->layout.regions; i++){
+        parts[count++] = (struct iovec){rows->hash[i], n * sizeof(uint64_t)};
+    }
+    parts[count++] = (struct iovec){rows->id, n * sizeof(uint32_t)};
+    for(i = 0; i < RF_SIZE; i++){
+        parts[count++] = (struct iovec){rows->regfile[i], n * sizeof(uint32_t)};
+    }
+    parts[count++] = (struct iovec){rows->flags, n};
+    parts[count++] = (struct iovec){rows->fault, n};
+    parts[count++] = (struct iovec){(void *)pad, group.size - size};
+
+    if((written = writev(sched->results, parts, count)) != group.size){
+        if(written < 0){
+            perror("results: writev");
+        }else{
+            printf("results: writev: wrote %zd of %u bytes\n", written, group.size);
+        }
+        __atomic_fetch_add(&sched->lost, n, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Rebase:  Move the decoded blocks over to memory, dropping the pages 
+ *          whose code differs there.  memory is checked against the 
+ *          bytes the thread decoded from, never against the memory it
+ *          ran before, which another thread may since have changed.
+ ***********************************************************************/
+void dpu_rebase(const unsigned char * memory){
+    struct dpu_page * page;
+    const unsigned char * bytes;
+    unsigned int i;
+
+    for(i = 0; i < CODE_PAGES; i++){
+        if((page = code_pages[i]) == NULL || page->lo >= page->hi){
+            continue;
+        }
+        bytes = page->bytes != NULL ? page->bytes : page->copy;
+        if(memcmp(bytes + (page->lo & PAGE_MASK), memory + page->lo, page->hi - page->lo) != 0){
+            dpu_invalidate(i << PAGE_SHIFT);
+            code_written[i] = 0;
+        }
+    }
+    dpu_reclaim();
+}
+
+
+/********************************************************************
+ * Bus Init:  Map the devices into their slots.
+ ***********************************************************************/
+void dpu_busInit(){
+    bus[DEV_CONSOLE].load = dpu_conLoad;
+    bus[DEV_CONSOLE].store = dpu_conStore;
+    bus[DEV_DISK].load = dpu_diskLoad;
+    bus[DEV_DISK].store = dpu_diskStore;
+    bus[DEV_TIMER].load = dpu_timerLoad;
+    bus[DEV_TIMER].store = dpu_timerStore;
+    bus[DEV_TIMER].local = 1;
+    bus[DEV_MMU].load = dpu_mmuLoad;
+    bus[DEV_MMU].store = dpu_mmuStore;
+    bus[DEV_MMU].local = 1;
+}
+
+
+/********************************************************************
+ * Timer Load/Store:  Registers of the core's timer.  Setting the period
+ *                    restarts the timer, and leaves the block being run 
+ *                    so that the alarm is seen in time.  Translated code
+ *                    does not look at alarms, so it hands back as well.
+ ***********************************************************************/
+uint32_t dpu_timerLoad(uint32_t reg, void * memory){
+    (void)memory;
+
+    switch(reg){
+        case TIMER_COUNT:
+            return (uint32_t)icount;
+        case TIMER_PERIOD:
+            return timer_period;
+        case TIMER_VECTOR:
+            return timer_vector;
+    }
+
+    return 0;
+}
+
+int dpu_timerStore(uint32_t reg, uint32_t value, void * memory){
+    unsigned int i;
+
+    (void)memory;
+    if(reg == TIMER_PERIOD){
+        timer_period = value;
+        for(i = 0; i < alarm_count; i++){
+            if(alarms[i].type == ALARM_TIMER){
+                dpu_alarmRemove(i);
+                break;
+            }
+        }
+        if(value != 0){
+            dpu_alarmAdd(icount + value, ALARM_TIMER);
+        }
+        dpu_alarmNext();
+        block_exit = 1;
+        return DEV_LEAVE;
+    }else if(reg == TIMER_VECTOR){
+        timer_vector = value;
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * MMU Load/Store:  Registers of the core's MMU.  Turning it on or off, or
+ *                  moving the table, empties the TLBs and leaves the 
+ *                  block being run, so that the next is found through the
+ *                  new mapping.
+ ***********************************************************************/
+uint32_t dpu_mmuLoad(uint32_t reg, void * memory){
+    (void)memory;
+
+    switch(reg){
+        case MMU_CTRL:
+            return mmu_on;
+        case MMU_TABLE:
+            return mmu_table;
+        case MMU_FAULT:
+            return mmu_fault;
+    }
+
+    return 0;
+}
+
+int dpu_mmuStore(uint32_t reg, uint32_t value, void * memory){
+    (void)memory;
+
+    if(reg == MMU_CTRL){
+        mmu_on = value & MMU_ENABLE;
+    }else if(reg == MMU_TABLE){
+        mmu_table = value;
+    }else{
+        return 0;
+    }
+    dpu_mmuFlush();
+    block_exit = 1;
+
+    return DEV_LEAVE;
+}
+
+
+/********************************************************************
+ * MMU Walk:  Map addr for an access that missed in the TLB, by the entry
+ *            for its page in the page table.  The mapping is put in the
+ *            access's TLB, unless it is a store into the table's own 
+ *            page, which empties the TLBs instead, as the store may 
+ *            change an entry.  The device range maps to itself.  Returns
+ *            MMU_NONE, with FAULT_PAGE raised, if the access is not 
+ *            allowed.
+ ***********************************************************************/
+uint32_t dpu_mmuWalk(uint32_t addr, uint32_t access, void * memory){
+    unsigned char * mem = memory;
+    struct dpu_tlb * tlb;
+    uint32_t page = addr >> MMU_SHIFT;
+    uint32_t entry, frame, at;
+
+    if(DEV_HIT(addr)){
+        return addr;
+    }
+    if(page >= MMU_ENTRIES || mmu_table > MEM_SIZE - MMU_ENTRIES * REG_SIZE){
+        mmu_fault = addr;
+        dpu_fault(FAULT_PAGE);
+        return MMU_NONE;
+    }
+    at = mmu_table + page * REG_SIZE;
+    entry = (uint32_t)mem[at] << SHIFT_3BYTE | mem[at + 1] << SHIFT_2BYTE 
+        | mem[at + 2] << SHIFT_BYTE | mem[at + 3];
+    frame = entry & ~(MMU_PAGE - 1);
+    if(!(entry & MMU_VALID) || !(entry & access) || frame > MEM_SIZE - MMU_PAGE){
+        mmu_fault = addr;
+        dpu_fault(FAULT_PAGE);
+        return MMU_NONE;
+    }
+
+    if(access == MMU_WRITE && frame < mmu_table + MMU_ENTRIES * REG_SIZE && mmu_table < frame + MMU_PAGE){
+        dpu_mmuFlush();
+    }else{
+        tlb = access == MMU_READ ? tlb_read : access == MMU_WRITE ? tlb_write : tlb_exec;
+        tlb[page & TLB_MASK].page = page;
+        tlb[page & TLB_MASK].delta = frame - (page << MMU_SHIFT);
+    }
+
+    return frame | (addr & (MMU_PAGE - 1));
+}
+
+
+/********************************************************************
+ * MMU Split:  Fault a word access at addr that runs off the end of its 
+ *             page.  Only its first page would be mapped, and the rest
+ *             of the word is not in the frame that follows.  Returns 
+ *             MMU_NONE.
+ ***********************************************************************/
+uint32_t dpu_mmuSplit(uint32_t addr){
+    mmu_fault = addr;
+    dpu_fault(FAULT_PAGE);
+
+    return MMU_NONE;
+}
+
+
+/********************************************************************
+ * MMU Flush:  Empty the TLBs.
+ ***********************************************************************/
+void dpu_mmuFlush(){
+    unsigned int i;
+
+    for(i = 0; i < TLB_SIZE; i++){
+        tlb_read[i].page = MMU_NONE;
+        tlb_write[i].page = MMU_NONE;
+        tlb_exec[i].page = MMU_NONE;
+    }
+}
+
+
+/********************************************************************
+ * Alarm Add:  Set an alarm of type to go off at instruction when, 
+ *             sifting it up the heap to its place.
+ ***********************************************************************/
+void dpu_alarmAdd(uint64_t when, uint32_t type){
+    unsigned int i;
+
+    if(alarm_count == ALARM_SLOTS){
+        return;
+    }
+
+    for(i = alarm_count++; i > 0 && alarms[(i - 1) / 2].when > when; i = (i - 1) / 2){
+        alarms[i] = alarms[(i - 1) / 2];
+    }
+    alarms[i].when = when;
+    alarms[i].type = type;
+    alarms[i].pad = 0;
+}
+
+
+/********************************************************************
+ * Alarm Remove:  Take the alarm at index out of the heap.  The last 
+ *                alarm fills the hole, and is sifted down or up.
+ ***********************************************************************/
+void dpu_alarmRemove(unsigned int index){
+    struct dpu_alarm last = alarms[--alarm_count];
+    unsigned int i = index, child;
+
+    if(index == alarm_count){
+        return;
+    }
+
+    forever{
+        child = 2 * i + 1;
+        if(child >= alarm_count){
+            break;
+        }
+        if(child + 1 < alarm_count && alarms[child + 1].when < alarms[child].when){
+            child++;
+        }
+        if(alarms[child].when >= last.when){
+            break;
+        }
+        alarms[i] = alarms[child];
+        i = child;
+    }
+    while(i > 0 && alarms[(i - 1) / 2].when > last.when){
+        alarms[i] = alarms[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    alarms[i] = last;
+}
+
+
+/********************************************************************
+ * Alarms:  Handle the alarms that are due, then take a waiting 
+ *          interrupt if the core is between pairs and not already 
+ *          handling one.
+ ***********************************************************************/
+void dpu_alarms(void * memory){
+    uint64_t when;
+    uint32_t type;
+
+    while(alarm_count > 0 && alarms[0].when <= icount){
+        when = alarms[0].when;
+        type = alarms[0].type;
+        dpu_alarmRemove(0);
+        if(type == ALARM_TIMER){
+            irq_pending = 1;
+            if(timer_period != 0){
+                dpu_alarmAdd(when + timer_period, ALARM_TIMER);
+            }
+        }
+    }
+
+    if(irq_pending && !flag_irq && flag_ir == 0 && !flag_stop){
+        irq_pending = 0;
+        dpu_interrupt(memory);
+    }
+
+    dpu_alarmNext();
+}
+
+
+/********************************************************************
+ * Alarm Next:  Work out when the run loop must next call dpu_alarms(): 
+ *              straight away if an interrupt can be taken, or else at 
+ *              the earliest alarm.
+ ***********************************************************************/
+void dpu_alarmNext(){
+    if(irq_pending && !flag_irq){
+        alarm_next = icount;
+    }else{
+        alarm_next = alarm_count > 0 ? alarms[0].when : NO_LIMIT;
+    }
+}
+
+
+/********************************************************************
+ * Interrupt:  Enter the timer's handler.  LR, the PC and the flags are
+ *             pushed the way PSH pushes, and LR is left holding 
+ *             IRQ_RETURN for the handler to return to.
+ ***********************************************************************/
+void dpu_interrupt(void * memory){
+    uint32_t flags = (flag_sign ? IRQ_SIGN : 0) | (flag_zero ? IRQ_ZERO : 0) 
+        | (flag_carry ? IRQ_CARRY : 0);
+
+    alu = SP + ~REG_SIZE + 1;
+    SP = alu;
+    dpu_storeReg(SP & SP_MASK, LR, memory);
+    alu = SP + ~REG_SIZE + 1;
+    SP = alu;
+    dpu_storeReg(SP & SP_MASK, PC, memory);
+    alu = SP + ~REG_SIZE + 1;
+    SP = alu;
+    dpu_storeReg(SP & SP_MASK, flags, memory);
+
+    LR = IRQ_RETURN;
+    PC = timer_vector;
+    flag_irq = 1;
+    if(cov_map != NULL){
+        dpu_edge(PC);
+    }
+}
+
+
+/********************************************************************
+ * IRQ Return:  Leave an interrupt handler, pulling back what 
+ *              dpu_interrupt() pushed.  An interrupt held while the 
+ *              handler ran is taken next.
+ ***********************************************************************/
+void dpu_irqReturn(void * memory){
+    uint32_t flags;
+
+    flags = dpu_loadReg(SP & SP_MASK, memory);
+    alu = SP + REG_SIZE;
+    SP = alu;
+    PC = dpu_loadReg(SP & SP_MASK, memory);
+    alu = SP + REG_SIZE;
+    SP = alu;
+    LR = dpu_loadReg(SP & SP_MASK, memory);
+    alu = SP + REG_SIZE;
+    SP = alu;
+
+    flag_sign = (flags & IRQ_SIGN) != 0;
+    flag_zero = (flags & IRQ_ZERO) != 0;
+    flag_carry = (flags & IRQ_CARRY) != 0;
+    flag_irq = 0;
+    dpu_alarmNext();
+    if(cov_map != NULL){
+        dpu_edge(PC);
+    }
+}
+
+
+/********************************************************************
+ * Bus Load:  Load the device register at addr, which must be in the 
+ *            device range.  Unless the device is local, the value comes
+ *            from outside the program, so it is recorded; while 
+ *            replaying, it is taken from the recording instead.
+ ***********************************************************************/
+uint32_t dpu_busLoad(uint32_t addr, void * memory){
+    struct dpu_device * dev = &bus[(addr - DEV_BASE) / DEV_SPAN];
+    struct dpu_replay * rp = bus_replay;
+    uint32_t value = 0;
+
+    bus_count++;
+    if(dev->local){
+        return dev->load((addr - DEV_BASE) % DEV_SPAN, memory);
+    }
+    if(rp != NULL){
+        while(rp->device < rp->count && rp->events[rp->device].type != EV_DEVICE){
+            rp->device++;
+        }
+        if(rp->device < rp->count && rp->events[rp->device].length == sizeof(value)){
+            memcpy(&value, rp->data[rp->device], sizeof(value));
+        }
+        rp->device++;
+        return value;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    value = dev->load((addr - DEV_BASE) % DEV_SPAN, memory);
+    dpu_recordEvent(EV_DEVICE, addr, sizeof(value), &value);
+    pthread_mutex_unlock(&bus_lock);
+
+    return value;
+}
+
+
+/********************************************************************
+ * Bus Store:  Store value into the device register at addr, which must
+ *             be in the device range.  Returns the DEV_LEAVE and 
+ *             DEV_CODE bits the device asks of the code running.  Only 
+ *             local devices are stored to while replaying.
+ ***********************************************************************/
+int dpu_busStore(uint32_t addr, uint32_t value, void * memory){
+    struct dpu_device * dev = &bus[(addr - DEV_BASE) / DEV_SPAN];
+    int hit;
+
+    bus_count++;
+    if(dev->local){
+        return dev->store((addr - DEV_BASE) % DEV_SPAN, value, memory);
+    }
+    if(bus_replay != NULL){
+        return 0;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    hit = dev->store((addr - DEV_BASE) % DEV_SPAN, value, memory);
+    pthread_mutex_unlock(&bus_lock);
+
+    return hit;
+}
+
+
+/********************************************************************
+ * AOT Load/Store:  Device access from translated code, which keeps the
+ *                  processor in its own state.  The state is moved into
+ *                  the registers around the access, as devices such as
+ *                  the timer work on them.
+ ***********************************************************************/
+uint32_t dpu_aotLoad(struct dpu_state * s, uint32_t addr, unsigned char * m){
+    uint32_t value;
+
+    dpu_restore(s);
+    value = dpu_busLoad(addr, m);
+    dpu_save(s);
+
+    return value;
+}
+
+int dpu_aotStore(struct dpu_state * s, uint32_t addr, uint32_t value, unsigned char * m){
+    int hit;
+
+    dpu_restore(s);
+    hit = dpu_busStore(addr, value, m);
+    dpu_save(s);
+
+    return hit;
+}
+
+
+/********************************************************************
+ * Dirty:  Drop the decoded blocks over length bytes of memory from addr,
+ *         which a device is about to write.  Returns 1 if any code is 
+ *         written over.  The other cores are told by dpu_announceOver()
+ *         once the bytes are written.
+ ***********************************************************************/
+int dpu_dirty(uint32_t addr, uint32_t length){
+    uint32_t page, from, to, end = addr + length;
+    int hit = 0;
+
+    for(page = addr & ~PAGE_MASK; page < end; page += CODE_PAGE){
+        from = page < addr ? addr : page;
+        to = page + CODE_PAGE < end ? page + CODE_PAGE : end;
+        if(CODE_HIT(from, to - from)){
+            dpu_invalidate(from);
+            hit = 1;
+        }
+    }
+
+    return hit;
+}
+
+
+/********************************************************************
+ * Console Load/Store:  Registers of the console.  Output bytes gather 
+ *                      in the buffer, which is written out when full 
+ *                      or when asked.
+ ***********************************************************************/
+uint32_t dpu_conLoad(uint32_t reg, void * memory){
+    (void)memory;
+
+    return reg == CON_DATA ? console.length : 0;
+}
+
+int dpu_conStore(uint32_t reg, uint32_t value, void * memory){
+    (void)memory;
+
+    if(reg == CON_DATA){
+        console.buff[console.length++] = value & BYTE_MASK;
+        if(console.length == CON_BUFF){
+            dpu_conFlush();
+        }
+    }else if(reg == CON_FLUSH){
+        dpu_conFlush();
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Console Flush:  Write out the console buffer in one piece.  Called 
+ *                 with the bus locked, or with no program running.
+ ***********************************************************************/
+void dpu_conFlush(){
+    if(console.length == 0){
+        return;
+    }
+    if(fwrite(console.buff, 1, console.length, stdout) != console.length){
+        perror("console: fwrite");
+    }
+    fflush(stdout);
+    console.length = 0;
+}
+
+
+/********************************************************************
+ * Disk Attach:  Back the disk with a file, opened for reading and 
+ *               writing.  Whole sectors of the file can be transferred.
+ ***********************************************************************/
+int dpu_diskAttach(){
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    FILE * file;
+    long size;
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+
+    if((file = fopen(filename, "r+b")) == NULL){
+        sprintf(error, "disk: fopen: %s", filename);
+        perror(error);
+        return -1;
+    }
+    if(fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0){
+        perror("disk: fseek");
+        fclose(file);
+        return -1;
+    }
+
+    if(disk.file != NULL){
+        fclose(disk.file);
+    }
+    memset(&disk, 0, sizeof(disk));
+    disk.file = file;
+    disk.size = size / SECTOR_SIZE;
+
+    printf("%u sectors attached from %s.\n", disk.size, filename);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Disk Load/Store:  Registers of the disk.  Writing DISK_CMD moves 
+ *                   DISK_COUNT sectors from DISK_SECTOR straight 
+ *                   between the file and memory at DISK_ADDR.  Data read
+ *                   into memory is recorded, as it comes from outside
+ *                   the program.
+ ***********************************************************************/
+uint32_t dpu_diskLoad(uint32_t reg, void * memory){
+    (void)memory;
+
+    switch(reg){
+        case DISK_SECTOR:
+            return disk.sector;
+        case DISK_ADDR:
+            return disk.addr;
+        case DISK_COUNT:
+            return disk.count;
+        case DISK_STATUS:
+            return disk.status;
+        case DISK_SIZE:
+            return disk.size;
+    }
+
+    return 0;
+}
+
+int dpu_diskStore(uint32_t reg, uint32_t value, void * memory){
+    unsigned char * mem = memory;
+    uint32_t length;
+    size_t done;
+    int hit = 0;
+
+    switch(reg){
+        case DISK_SECTOR:
+            disk.sector = value;
+            break;
+        case DISK_ADDR:
+            disk.addr = value;
+            break;
+        case DISK_COUNT:
+            disk.count = value;
+            break;
+        case DISK_CMD:
+            disk.status = DISK_ERROR;
+            if(disk.file == NULL || disk.count > MEM_SIZE / SECTOR_SIZE 
+                    || disk.count > disk.size || disk.sector > disk.size - disk.count){
+                break;
+            }
+            length = disk.count * SECTOR_SIZE;
+            if(disk.addr > MEM_SIZE - length 
+                    || fseek(disk.file, (long)disk.sector * SECTOR_SIZE, SEEK_SET) != 0){
+                break;
+            }
+            if(value == DISK_READ){
+                hit = dpu_dirty(disk.addr, length) ? DEV_CODE : 0;
+                done = fread(mem + disk.addr, SECTOR_SIZE, disk.count, disk.file);
+                dpu_announceOver(disk.addr, length);
+                if(done != disk.count){
+                    break;
+                }
+                dpu_recordEvent(EV_MEMORY, disk.addr, length, mem + disk.addr);
+            }else if(value == DISK_WRITE){
+                if(fwrite(mem + disk.addr, SECTOR_SIZE, disk.count, disk.file) != disk.count
+                        || fflush(disk.file) == EOF){
+                    break;
+                }
+            }else{
+                break;
+            }
+            disk.status = DISK_OK;
+            break;
+    }
+
+    return hit;
+}
+
+
+/********************************************************************
+ * Op:  The op number of inst.
+ ***********************************************************************/
+int dpu_op(uint16_t inst){
+    uint16_t cir = inst;
+
+    if(DATA_PROC){
+        return OP_DATA + OPERATION;
+    }else if(LOAD_STORE){
+        return OP_LDR + !LOAD_BIT + 2 * BYTE_BIT;
+    }else if(IMMEDIATE){
+        return OP_MOVI + OPCODE;
+    }else if(COND_BRANCH){
+        return OP_BCC;
+    }else if(PUSH_PULL){
+        return LOAD_BIT ? OP_PUL : OP_PSH;
+    }else if(BRANCH){
+        return LINK_BIT ? OP_BL : OP_B;
+    }else if(STOP){
+        return OP_STOP;
+    }else if(EXT_SWP){
+        return OP_SWP;
+    }else if(EXT_LDX){
+        return OP_LDX;
+    }else if(EXT_STX){
+        return OP_STX;
+    }else if(EXT_CPY){
+        return OP_CPY;
+    }else if(EXT_FIL){
+        return OP_FIL;
+    }
+
+    return OP_EXT;
+}
+
+
+/********************************************************************
+ * Pairs:  Run the program one instruction at a time, up to a count 
+ *         or until it stops, counting each pair of instructions run 
+ *         one after the other by their op numbers.  The PAIR_TOP pairs
+ *         run most are listed, with how many of them were the two 
+ *         halves of one word, which is where pairs can be fused, and 
+ *         how many ran fused in the block engine.
+ ***********************************************************************/
+void dpu_pairs(void * memory){
+    unsigned long long target, total = 0, fused = 0;
+    uint64_t * counts;
+    uint64_t * words;
+    uint64_t before;
+    unsigned int i, top, best;
+    int op, last = -1;
+    uint8_t second;
+    unsigned char flush[BUFF_SIZE];
+
+    printf("Enter instruction count (0 for the end):\t");
+    if(scanf("%llu", &target) == 0){
+        printf("Not a valid count.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    target = target == 0 ? NO_LIMIT : icount + target;
+
+    counts = calloc(OP_COUNT * OP_COUNT, sizeof(uint64_t));
+    words = calloc(OP_COUNT * OP_COUNT, sizeof(uint64_t));
+    if(counts == NULL || words == NULL){
+        printf("Not enough memory to count pairs.\n");
+        free(counts);
+        free(words);
+        return;
+    }
+
+    while(!flag_stop && icount < target){
+        if(icount >= alarm_next){
+            dpu_alarms(memory);
+        }
+        second = flag_ir;
+        before = icount;
+        dpu_instCycle(memory);
+        /* A return from an interrupt runs no instruction */
+        if(icount == before){
+            continue;
+        }
+        op = dpu_op(cir);
+        if(last >= 0){
+            counts[last * OP_COUNT + op]++;
+            total++;
+            if(second){
+                words[last * OP_COUNT + op]++;
+                if(dpu_fuse(ir) != FUSE_NONE){
+                    fused++;
+                }
+            }
+        }
+        last = op;
+    }
+
+    printf("%llu pairs run, %llu of them fused.\n", total, fused);
+    printf("  First  Second          Count      %%      In word\n");
+    for(top = 0; top < PAIR_TOP; top++){
+        best = 0;
+        for(i = 1; i < OP_COUNT * OP_COUNT; i++){
+            if(counts[i] > counts[best]){
+                best = i;
+            }
+        }
+        if(counts[best] == 0){
+            break;
+        }
+        printf("  %-6s %-6s %14llu %6.2f %12llu\n", mnemonics[best / OP_COUNT], 
+                mnemonics[best % OP_COUNT], (unsigned long long)counts[best], 
+                100.0 * counts[best] / total, (unsigned long long)words[best]);
+        counts[best] = 0;
+    }
+
+    free(counts);
+    free(words);
+}
+
+
+/********************************************************************
+ * Select:  Pick the engine for a run started from the prompt: the debug
+ *          engine if anything is set with the x command, the coverage 
+ *          engine while fuzzing, and the fast engine otherwise.
+ ***********************************************************************/
+void dpu_select(){
+    if(debug.break_count != 0 || debug.trace != NULL || debug.profile != NULL){
+        engine_kind = ENGINE_DEBUG;
+    }else if(cov_map != NULL){
+        engine_kind = ENGINE_COVER;
+    }else{
+        engine_kind = ENGINE_FAST;
+    }
+    debug.resume = icount;
+    debug.hit = 0;
+}
+
+
+/********************************************************************
+ * Observe:  Trace and profile the instruction in cir, which the debug 
+ *           engine is about to execute.
+ ***********************************************************************/
+void dpu_observe(){
+    uint32_t addr = PC - REG_SIZE + (flag_ir ? 0 : THUMB_SIZE);
+
+    if(debug.profile != NULL && addr < MEM_SIZE){
+        debug.profile[addr / THUMB_SIZE]++;
+    }
+    if(debug.trace != NULL){
+        fprintf(debug.trace, "%llu %08X %04X %s\n", (unsigned long long)icount, 
+                addr, cir, mnemonics[dpu_op(cir)]);
+    }
+}
+
+
+/********************************************************************
+ * Break At:  Nonzero if the pair at pc is at a breakpoint, and the run
+ *            must stop before it.  Sets debug.hit if so.
+ ***********************************************************************/
+int dpu_breakAt(uint32_t pc){
+    unsigned int i;
+
+    if(icount == debug.resume){
+        return 0;
+    }
+    for(i = 0; i < debug.break_count; i++){
+        if(debug.breaks[i] == (pc & ~(REG_SIZE - 1))){
+            debug.hit = 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Debug Set:  Add or clear breakpoints, start or stop a trace, and 
+ *             start or stop the profile, listing it when it stops.
+ ***********************************************************************/
+void dpu_debugSet(void * memory){
+    unsigned char choice[BUFF_SIZE];
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    unsigned int addr;
+
+    printf("Enter b to add a breakpoint, c to clear breakpoints, t to start or stop\n"
+            "tracing, p to start or stop profiling, s to start or stop sampling, or j\n"
+            "to start or stop writing a jitdump:\t");
+    fgets(choice, BUFF_SIZE, stdin);
+
+    switch(tolower(choice[0])){
+        case 'b':
+            printf("Enter address in hex:\t");
+            if(scanf("%x", &addr) == 0 || addr >= MEM_SIZE){
+                printf("Not a valid address.\n");
+            }else if(debug.break_count == BREAK_SLOTS){
+                printf("No more than %d breakpoints can be set.\n", BREAK_SLOTS);
+            }else{
+                debug.breaks[debug.break_count++] = addr & ~(REG_SIZE - 1);
+                printf("Breakpoint set at %08X.\n", addr & ~(REG_SIZE - 1));
+            }
+            fgets(choice, BUFF_SIZE, stdin);
+            break;
+        case 'c':
+            debug.break_count = 0;
+            printf("Breakpoints cleared.\n");
+            break;
+        case 't':
+            if(debug.trace != NULL){
+                fclose(debug.trace);
+                debug.trace = NULL;
+                printf("Tracing stopped.\n");
+                break;
+            }
+            printf("\nEnter a filename: ");
+            fgets(filename, BUFF_SIZE, stdin);
+            filename[strlen(filename) - 1] = '\0';
+            if((debug.trace = fopen(filename, "w")) == NULL){
+                sprintf(error, "trace: fopen: %s", filename);
+                perror(error);
+                break;
+            }
+            printf("Tracing to %s.\n", filename);
+            break;
+        case 'p':
+            if(debug.profile != NULL){
+                dpu_profile(memory, debug.profile, "instructions profiled");
+                free(debug.profile);
+                debug.profile = NULL;
+                break;
+            }
+            if((debug.profile = calloc(MEM_SIZE / THUMB_SIZE, sizeof(uint64_t))) == NULL){
+                printf("Not enough memory to profile.\n");
+                break;
+            }
+            printf("Profiling started.\n");
+            break;
+        case 's':
+            dpu_sampleSet(memory);
+            break;
+        case 'j':
+            dpu_jitSet();
+            break;
+        default:
+            printf("Not a valid choice.\n");
+    }
+}
+
+
+/********************************************************************
+ * Profile:  List the PROFILE_TOP addresses with the highest counts, 
+ *           kept by halfword, of what was counted.  The counts listed
+ *           are cleared.
+ ***********************************************************************/
+void dpu_profile(void * memory, uint64_t * counts, const char * what){
+    unsigned char * mem = memory;
+    unsigned long long total = 0;
+    unsigned int i, top, best;
+    uint64_t count;
+
+    for(i = 0; i < MEM_SIZE / THUMB_SIZE; i++){
+        total += counts[i];
+    }
+    printf("%llu %s.\n", total, what);
+    printf("  Address           Count      %%  Op\n");
+    for(top = 0; top < PROFILE_TOP; top++){
+        best = 0;
+        for(i = 1; i < MEM_SIZE / THUMB_SIZE; i++){
+            if(counts[i] > counts[best]){
+                best = i;
+            }
+        }
+        if((count = counts[best]) == 0){
+            break;
+        }
+        printf("  %08X %14llu %6.2f  %s\n", best * THUMB_SIZE, (unsigned long long)count,
+                100.0 * count / total, mnemonics[dpu_op(mem[best * THUMB_SIZE] << SHIFT_BYTE | mem[best * THUMB_SIZE + 1])]);
+        counts[best] = 0;
+    }
+}
+
+
+/********************************************************************
+ * Sample Set:  Start sampling the PC, or stop and list where the 
+ *              samples fell.
+ ***********************************************************************/
+int dpu_sampleSet(void * memory){
+    struct itimerval timer;
+    struct sigaction action;
+    uint64_t * counts = sampler.counts;
+
+    memset(&timer, 0, sizeof(timer));
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+
+    if(counts != NULL){
+        setitimer(ITIMER_PROF, &timer, NULL);
+        action.sa_handler = SIG_IGN;
+        sigaction(SIGPROF, &action, NULL);
+        __atomic_store_n(&sampler.counts, NULL, __ATOMIC_RELEASE);
+        dpu_profile(memory, counts, "samples taken");
+        printf("%llu samples fell in translated code.\n", (unsigned long long)sampler.aot);
+        free(counts);
+        return 0;
+    }
+
+    if((counts = calloc(MEM_SIZE / THUMB_SIZE, sizeof(uint64_t))) == NULL){
+        printf("Not enough memory to sample.\n");
+        return -1;
+    }
+    sampler.aot = 0;
+    __atomic_store_n(&sampler.counts, counts, __ATOMIC_RELEASE);
+
+    action.sa_handler = dpu_sample;
+    action.sa_flags = SA_RESTART;
+    timer.it_interval.tv_usec = SAMPLE_USEC;
+    timer.it_value.tv_usec = SAMPLE_USEC;
+    if(sigaction(SIGPROF, &action, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0){
+        perror("sample: setitimer");
+        sampler.counts = NULL;
+        free(counts);
+        return -1;
+    }
+    printf("Sampling started.\n");
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Sample:  Count the pair the interrupted thread is running, as the
+ *          profiling timer goes off.  PC is past the pair once it has
+ *          been fetched.
+ ***********************************************************************/
+void dpu_sample(int sig){
+    struct dpu_state * state = sample_state;
+    uint64_t * counts = __atomic_load_n(&sampler.counts, __ATOMIC_ACQUIRE);
+    uint32_t pc = state != NULL ? state->regfile[RF_PC] : PC;
+
+    (void)sig;
+    if(counts == NULL){
+        return;
+    }
+    if(state != NULL){
+        __atomic_fetch_add(&sampler.aot, 1, __ATOMIC_RELAXED);
+    }
+    pc -= REG_SIZE;
+    if(pc < MEM_SIZE){
+        __atomic_fetch_add(&counts[pc / THUMB_SIZE], 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/********************************************************************
+ * Cache Sim:  Run the program on the cache engine, for a count of 
+ *             instructions or to the end, feeding its memory accesses
+ *             through the cache model set up from the user's sizes and
+ *             latencies, and report how the caches did.
+ ***********************************************************************/
+int dpu_cacheSim(void * memory){
+    unsigned char flush[BUFF_SIZE];
+    unsigned long long target;
+    uint64_t before = icount;
+
+    memset(&caches, 0, sizeof(caches));
+    if(dpu_cacheSet(&caches.l1i, "L1 instruction") != 0 || dpu_cacheSet(&caches.l1d, "L1 data") != 0
+            || dpu_cacheSet(&caches.l2, "L2") != 0){
+        dpu_cacheFree();
+        return -1;
+    }
+    if(caches.l2.line < caches.l1i.line || caches.l2.line < caches.l1d.line){
+        printf("The L2 line size must be no smaller than the L1 line sizes.\n");
+        dpu_cacheFree();
+        return -1;
+    }
+
+    printf("Enter L2 and memory latency in cycles:\t");
+    if(scanf("%u %u", &caches.l2_cycles, &caches.mem_cycles) != 2){
+        printf("Not valid latencies.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        dpu_cacheFree();
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    printf("Enter instruction count (0 for the end):\t");
+    if(scanf("%llu", &target) == 0){
+        printf("Not a valid count.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        dpu_cacheFree();
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    target = target == 0 ? NO_LIMIT : icount + target;
+
+    caches.cycles = calloc(MEM_SIZE / THUMB_SIZE, sizeof(uint64_t));
+    caches.misses = calloc(MEM_SIZE / THUMB_SIZE, sizeof(uint64_t));
+    if(caches.cycles == NULL || caches.misses == NULL){
+        printf("Not enough memory to simulate the caches.\n");
+        dpu_cacheFree();
+        return -1;
+    }
+
+    cache_count = 0;
+    engine_kind = ENGINE_CACHE;
+    dpu_run(memory, target, 1);
+    engine_kind = ENGINE_FAST;
+    dpu_cacheDrain();
+
+    dpu_cacheReport(memory, icount - before);
+    dpu_cacheFree();
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Cache Set:  Ask for the size, ways and line size of cache, all powers
+ *             of two, and make it empty.
+ ***********************************************************************/
+int dpu_cacheSet(struct dpu_cache * cache, const char * name){
+    unsigned char flush[BUFF_SIZE];
+
+    printf("Enter %s size, ways and line size in hex:\t", name);
+    if(scanf("%x %x %x", &cache->size, &cache->ways, &cache->line) != 3){
+        printf("Not a valid cache.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    if(cache->ways == 0 || cache->ways > CACHE_WAYS || cache->line < REG_SIZE 
+            || cache->line > MEM_SIZE || (cache->line & (cache->line - 1)) != 0 
+            || (cache->ways & (cache->ways - 1)) != 0 || (cache->size & (cache->size - 1)) != 0
+            || cache->size < cache->ways * cache->line){
+        printf("Not a valid cache: sizes must be powers of two, with no more than %d ways.\n", CACHE_WAYS);
+        return -1;
+    }
+    cache->name = name;
+    cache->sets = cache->size / (cache->ways * cache->line);
+    cache->shift = __builtin_ctz(cache->line);
+    cache->tags = calloc(cache->sets * cache->ways, sizeof(uint32_t));
+    cache->used = calloc(cache->sets * cache->ways, sizeof(uint64_t));
+    if(cache->tags == NULL || cache->used == NULL){
+        printf("Not enough memory for the %s cache.\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Cache Drain:  Feed the batch of accesses through the cache model.  An
+ *               access is looked up in the L1 for its kind, a line at a
+ *               time, and each line the L1 misses in the L2.
+ ***********************************************************************/
+void dpu_cacheDrain(){
+    struct dpu_access * access;
+    struct dpu_cache * l1;
+    uint32_t line, last;
+    unsigned int i, extra;
+
+    for(i = 0; i < cache_count; i++){
+        access = &cache_batch[i];
+        caches.accesses++;
+        if(access->addr > MEM_SIZE - (uint32_t)access->size){
+            caches.uncached++;
+            continue;
+        }
+        l1 = access->kind == ACCESS_FETCH ? &caches.l1i : &caches.l1d;
+        last = (access->addr + access->size - 1) >> l1->shift;
+        for(line = access->addr >> l1->shift; line <= last; line++){
+            if(dpu_cacheLook(l1, line)){
+                continue;
+            }
+            extra = caches.l2_cycles;
+            if(!dpu_cacheLook(&caches.l2, (line << l1->shift) >> caches.l2.shift)){
+                extra += caches.mem_cycles;
+            }
+            caches.added += extra;
+            if(access->pc < MEM_SIZE){
+                caches.cycles[access->pc / THUMB_SIZE] += extra;
+                caches.misses[access->pc / THUMB_SIZE]++;
+            }
+        }
+    }
+    cache_count = 0;
+}
+
+
+/********************************************************************
+ * Cache Look:  Look up line in cache, returning 1 on a hit.  On a miss
+ *              the line is put in place of the least recently used way
+ *              of its set.
+ ***********************************************************************/
+int dpu_cacheLook(struct dpu_cache * cache, uint32_t line){
+    unsigned int set = (line & (cache->sets - 1)) * cache->ways;
+    uint32_t * tags = cache->tags + set;
+    uint64_t * used = cache->used + set;
+    unsigned int w, oldest = 0;
+
+    caches.clock++;
+    for(w = 0; w < cache->ways; w++){
+        if(tags[w] == line + 1){
+            used[w] = caches.clock;
+            cache->hits++;
+            return 1;
+        }
+        if(used[w] < used[oldest]){
+            oldest = w;
+        }
+    }
+    tags[oldest] = line + 1;
+    used[oldest] = caches.clock;
+    cache->misses++;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Cache Report:  Show the hits and misses of each cache, the cycles the
+ *                misses added to the instructions run, and the 
+ *                CACHE_TOP addresses whose accesses added the most.
+ ***********************************************************************/
+void dpu_cacheReport(void * memory, uint64_t instructions){
+    struct dpu_cache * levels[] = {&caches.l1i, &caches.l1d, &caches.l2};
+    unsigned char * mem = memory;
+    unsigned int i, top, best;
+    uint64_t looked;
+
+    printf("%llu instructions made %llu accesses, %llu of them to devices.\n", 
+            (unsigned long long)instructions, (unsigned long long)caches.accesses, 
+            (unsigned long long)caches.uncached);
+    printf("  Cache             Size  Ways  Line         Hits       Misses  Hit %%\n");
+    for(i = 0; i < sizeof(levels) / sizeof(levels[0]); i++){
+        looked = levels[i]->hits + levels[i]->misses;
+        printf("  %-14s %7X %5u %5X %12llu %12llu %6.2f\n", levels[i]->name, levels[i]->size, 
+                levels[i]->ways, levels[i]->line, (unsigned long long)levels[i]->hits, 
+                (unsigned long long)levels[i]->misses, looked ? 100.0 * levels[i]->hits / looked : 0.0);
+    }
+    printf("%llu cycles added, %.3f an instruction.\n", (unsigned long long)caches.added,
+            instructions ? (double)caches.added / instructions : 0.0);
+
+    printf("  Address         Cycles       Misses  Op\n");
+    for(top = 0; top < CACHE_TOP; top++){
+        best = 0;
+        for(i = 1; i < MEM_SIZE / THUMB_SIZE; i++){
+            if(caches.cycles[i] > caches.cycles[best]){
+                best = i;
+            }
+        }
+        if(caches.cycles[best] == 0){
+            break;
+        }
+        printf("  %08X %14llu %12llu  %s\n", best * THUMB_SIZE, (unsigned long long)caches.cycles[best],
+                (unsigned long long)caches.misses[best], 
+                mnemonics[dpu_op(mem[best * THUMB_SIZE] << SHIFT_BYTE | mem[best * THUMB_SIZE + 1])]);
+        caches.cycles[best] = 0;
+    }
+}
+
+
+/********************************************************************
+ * Cache Free:  Free the caches of the model.
+ ***********************************************************************/
+void dpu_cacheFree(){
+    free(caches.l1i.tags);
+    free(caches.l1i.used);
+    free(caches.l1d.tags);
+    free(caches.l1d.used);
+    free(caches.l2.tags);
+    free(caches.l2.used);
+    free(caches.cycles);
+    free(caches.misses);
+    memset(&caches, 0, sizeof(caches));
+}
+
+
+/********************************************************************
+ * Tally To:  Count what this thread runs from now on into metrics.
+ ***********************************************************************/
+void dpu_tallyTo(struct dpu_metrics * metrics){
+    dpu_tally();
+    tally = metrics;
+    tally_base = counts;
+    tally_icount = icount;
+    tally_next = icount + TALLY_INTERVAL;
+}
+
+
+/********************************************************************
+ * Tally:  Add what this thread counted since the last tally into the 
+ *         instance it is running.  Only this thread writes the
+ *         instance's counters, so they are read back plainly, and 
+ *         stored atomically for the exporter to read.
+ ***********************************************************************/
+void dpu_tally(){
+    unsigned int i;
+
+    if(tally == NULL){
+        return;
+    }
+    if(icount > tally_icount){
+        __atomic_store_n(&tally->instructions, tally->instructions + icount - tally_icount, __ATOMIC_RELAXED);
+    }
+    TALLY(branches);
+    TALLY(loads);
+    TALLY(stores);
+    TALLY(pushes);
+    TALLY(pulls);
+    TALLY(stops);
+    for(i = 0; i < FAULT_KINDS; i++){
+        TALLY(faults[i]);
+    }
+    tally_base = counts;
+    tally_icount = icount;
+    tally_next = icount + TALLY_INTERVAL;
+}
+
+
+/********************************************************************
+ * Enroll:  Put count instances of kind, stride bytes apart from first,
+ *          in a slot of the census.  A count of 0 takes them out, 
+ *          before they are freed.
+ ***********************************************************************/
+void dpu_enroll(unsigned int slot, const char * kind, void * first, size_t stride, unsigned int count){
+    pthread_mutex_lock(&census_lock);
+    census[slot].kind = kind;
+    census[slot].first = first;
+    census[slot].stride = stride;
+    census[slot].count = count;
+    pthread_mutex_unlock(&census_lock);
+}
+
+
+/********************************************************************
+ * Metrics Set:  Start writing the metrics to a file every
+ *               EXPORT_PERIOD seconds, or stop if they are being 
+ *               written already.
+ ***********************************************************************/
+int dpu_metricsSet(){
+    unsigned char filename[BUFF_SIZE];
+    int err;
+
+    if(export_file != NULL){
+        pthread_mutex_lock(&census_lock);
+        export_stop = 1;
+        pthread_cond_signal(&export_wake);
+        pthread_mutex_unlock(&census_lock);
+        pthread_join(export_thread, NULL);
+        printf("Metrics to %s stopped.\n", export_file);
+        free(export_file);
+        export_file = NULL;
+        return 0;
+    }
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+    if(filename[0] == '\0' || (export_file = (unsigned char *)strdup((char *)filename)) == NULL){
+        printf("Not a valid filename.\n");
+        return -1;
+    }
+    export_stop = 0;
+    if((err = pthread_create(&export_thread, NULL, dpu_exporter, NULL)) != 0){
+        printf("metrics: pthread_create: %s\n", strerror(err));
+        free(export_file);
+        export_file = NULL;
+        return -1;
+    }
+    printf("Writing metrics to %s every %ds.\n", export_file, EXPORT_PERIOD);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Exporter:  Thread body writing the metrics; arg is unused.  Every 
+ *            EXPORT_PERIOD seconds, and once more on being stopped, the
+ *            metrics are written beside export_file and renamed over it.
+ ***********************************************************************/
+void * dpu_exporter(void * arg){
+    unsigned char temp[BUFF_SIZE + 0x8];
+    unsigned char error[BUFF_SIZE + 0x20];
+    struct timespec wake, now, last;
+    uint8_t stop = 0;
+    FILE * out;
+
+    (void)arg;
+
+    sprintf(temp, "%s.tmp", export_file);
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    pthread_mutex_lock(&census_lock);
+    while(!stop){
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += EXPORT_PERIOD;
+        while(!export_stop && pthread_cond_timedwait(&export_wake, &census_lock, &wake) != ETIMEDOUT);
+        stop = export_stop;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if((out = fopen(temp, "w")) == NULL){
+            sprintf(error, "metrics: fopen: %s", temp);
+            perror(error);
+            continue;
+        }
+        dpu_export(out, (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9);
+        last = now;
+        if(fclose(out) != 0 || rename(temp, export_file) != 0){
+            sprintf(error, "metrics: %s", export_file);
+            perror(error);
+        }
+    }
+    pthread_mutex_unlock(&census_lock);
+
+    return NULL;
+}
+
+
+/********************************************************************
+ * Export:  Write the counters of every instance in the census to out,
+ *          in the Prometheus text format, with each instance's MIPS 
+ *          over the secs since the last export, and the totals of all.
+ *          Called holding census_lock.
+ ***********************************************************************/
+void dpu_export(FILE * out, double secs){
+    struct dpu_metrics * m;
+    unsigned char label[EXPORT_LABEL];
+    unsigned long long value, all = 0;
+    double mips, all_mips = 0;
+    unsigned int instances = 0;
+    unsigned int f, s, i, r;
+
+    for(f = 0; f < sizeof(families) / sizeof(families[0]); f++){
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", families[f].name, families[f].help, families[f].name);
+        for(s = 0; s < CENSUS_SLOTS; s++){
+            for(i = 0; i < census[s].count; i++){
+                m = (struct dpu_metrics *)(census[s].first + i * census[s].stride);
+                dpu_label(label, s, i);
+                value = __atomic_load_n((uint64_t *)((unsigned char *)m + families[f].offset), __ATOMIC_RELAXED);
+                fprintf(out, "%s{instance=\"%s\"} %llu\n", families[f].name, label, value);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP dpu_faults_total Faults, by reason.\n# TYPE dpu_faults_total counter\n");
+    for(s = 0; s < CENSUS_SLOTS; s++){
+        for(i = 0; i < census[s].count; i++){
+            m = (struct dpu_metrics *)(census[s].first + i * census[s].stride);
+            dpu_label(label, s, i);
+            for(r = FAULT_NONE + 1; r < FAULT_KINDS; r++){
+                value = __atomic_load_n(&m->faults[r], __ATOMIC_RELAXED);
+                fprintf(out, "dpu_faults_total{instance=\"%s\",reason=\"%s\"} %llu\n", label, fault_names[r], value);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP dpu_mips Millions of instructions a second since the last export.\n# TYPE dpu_mips gauge\n");
+    for(s = 0; s < CENSUS_SLOTS; s++){
+        for(i = 0; i < census[s].count; i++){
+            m = (struct dpu_metrics *)(census[s].first + i * census[s].stride);
+            dpu_label(label, s, i);
+            value = __atomic_load_n(&m->instructions, __ATOMIC_RELAXED);
+            mips = secs > 0 && value >= m->last ? (value - m->last) / secs / 1e6 : 0.0;
+            m->last = value;
+            fprintf(out, "dpu_mips{instance=\"%s\"} %.3f\n", label, mips);
+            all += value;
+            all_mips += mips;
+            instances++;
+        }
+    }
+
+    fprintf(out, "# HELP dpu_instances Instances running or run.\n# TYPE dpu_instances gauge\n"
+            "dpu_instances %u\n", instances);
+    fprintf(out, "# HELP dpu_all_instructions_total Instructions retired by all instances.\n"
+            "# TYPE dpu_all_instructions_total counter\ndpu_all_instructions_total %llu\n", all);
+    fprintf(out, "# HELP dpu_all_mips Millions of instructions a second of all instances.\n"
+            "# TYPE dpu_all_mips gauge\ndpu_all_mips %.3f\n", all_mips);
+}
+
+
+/********************************************************************
+ * Label:  Name instance i of census slot s in label, as "main", or as
+ *         the kind and number, "core3" or "guest17".
+ ***********************************************************************/
+void dpu_label(unsigned char * label, unsigned int s, unsigned int i){
+    if(s == CENSUS_MAIN){
+        snprintf(label, EXPORT_LABEL, "%s", census[s].kind);
+    }else{
+        snprintf(label, EXPORT_LABEL, "%s%u", census[s].kind, i);
+    }
+}
+
+
+/********************************************************************
+ * Edge:  Record the branch just made to pc in the coverage map, hashed
+ *        with the previous branch location the way AFL does.  A 
+ *        conditional branch records an edge whether it is taken or not,
+ *        so that the two ways out of it are told apart.
+ ***********************************************************************/
+void dpu_edge(uint32_t pc){
+    uint32_t loc = (pc * 0x9E3779B1) >> SHIFT_2BYTE;
+
+    cov_map[(loc ^ cov_prev) & FUZZ_MASK]++;
+    cov_prev = loc >> SHIFT_BIT;
+}
+
+
+/********************************************************************
+ * Fuzz:  Fuzz the program with mutated input written into a region of 
+ *        memory.  The processor and memory are snapshotted once, and 
+ *        every execution starts from the snapshot in-process, with no
+ *        reset or file load.  Branches record edge coverage into a 
+ *        private coverage map, cleared for each execution and added 
+ *        into AFL's shared memory map when FUZZ_ENV is set.  Inputs that
+ *        reach new edges join the corpus.  Inputs that fault, or run out
+ *        of their instruction budget, on a new path are written to files
+ *        as crashes or hangs.  Devices outside the core are swapped for
+ *        the null device while fuzzing, so that an input cannot write 
+ *        the disk or the console, and every execution sees the same 
+ *        devices.  The processor and memory are left as the snapshot.
+ ***********************************************************************/
+int dpu_fuzz(void * memory){
+    struct dpu_state snap;
+    struct timespec begin, end;
+    unsigned char flush[BUFF_SIZE];
+    unsigned char prefix[BUFF_SIZE];
+    unsigned char filename[BUFF_SIZE + 0x20];
+    unsigned char * mem = memory;
+    unsigned char * image = NULL;
+    unsigned char * input = NULL;
+    unsigned char * corpus[FUZZ_CORPUS];
+    uint8_t * virgin = NULL;
+    uint8_t * shared = NULL;
+    struct dpu_device devices[DEV_SLOTS];
+    unsigned int offset, length, budget, execs, i, n, page;
+    unsigned int count = 0, crashes = 0, hangs = 0, edges = 0;
+    uint8_t bucket;
+    int fresh;
+    double secs;
+    char * shmid;
+    FILE * file;
+
+    printf("Enter input offset in hex:\t");
+    if(scanf("%x", &offset) == 0 || offset >= MEM_SIZE){
+        printf("Not a valid offset.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter input length in hex:\t");
+    if(scanf("%x", &length) == 0 || length == 0 || length > MEM_SIZE - offset){
+        printf("Not a valid length.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter instruction budget per execution:\t");
+    if(scanf("%u", &budget) == 0 || budget == 0){
+        printf("Not a valid budget.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter number of executions:\t");
+    if(scanf("%u", &execs) == 0){
+        printf("Not a valid number.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+    printf("Enter a prefix for crash files: ");
+    fgets(prefix, BUFF_SIZE, stdin);
+    prefix[strlen(prefix) - 1] = '\0';
+
+    /* Coverage goes into AFL's map when run under it */
+    if((shmid = getenv(FUZZ_ENV)) != NULL){
+        if((shared = shmat(atoi(shmid), NULL, 0)) == (void *)-1){
+            perror("fuzz: shmat");
+            shared = NULL;
+        }
+    }
+    cov_map = malloc(FUZZ_MAP);
+    memcpy(devices, bus, sizeof(bus));
+    for(i = 0; i < DEV_SLOTS; i++){
+        if(!bus[i].local){
+            bus[i].load = dpu_nullLoad;
+            bus[i].store = dpu_nullStore;
+        }
+    }
+    engine_kind = ENGINE_COVER;
+    image = malloc(MEM_SIZE);
+    input = malloc(length);
+    virgin = calloc(FUZZ_MAP, 1);
+    if(cov_map == NULL || image == NULL || input == NULL || virgin == NULL){
+        perror("fuzz: malloc");
+        goto done;
+    }
+
+    /* The snapshot, and the input it holds, seed the corpus */
+    dpu_save(&snap);
+    snap.flag_stop = 0;
+    snap.fault = FAULT_NONE;
+    memcpy(image, memory, MEM_SIZE);
+    if((corpus[count] = malloc(length)) == NULL){
+        perror("fuzz: malloc");
+        goto done;
+    }
+    memcpy(corpus[count++], mem + offset, length);
+
+    if(fuzz_rng == 0){
+        fuzz_rng = (uint64_t)time(NULL) | 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for(n = 0; n < execs; n++){
+        /* Every new input is a mutation of one in the corpus */
+        memcpy(input, corpus[n % count], length);
+        if(n > 0){
+            dpu_mutate(input, length, corpus, count);
+        }
+
+        /* Reset from the snapshot.  Decoded pages are only dropped when
+         * the last execution changed their code. */
+        dpu_rebase(image);
+        memcpy(memory, image, MEM_SIZE);
+        for(page = offset >> PAGE_SHIFT; page <= (offset + length - 1) >> PAGE_SHIFT; page++){
+            if(code_pages[page] != NULL && offset + length > code_pages[page]->lo 
+                    && offset < code_pages[page]->hi && memcmp(mem + offset, input, length) != 0){
+                dpu_invalidate(page << PAGE_SHIFT);
+            }
+        }
+        memcpy(mem + offset, input, length);
+        dpu_reclaim();
+        snap.icount = icount;
+        dpu_restore(&snap);
+
+        memset(cov_map, 0, FUZZ_MAP);
+        cov_prev = 0;
+        dpu_run(memory, icount + budget, 1);
+
+        /* Look for edges, or edge hit counts, not seen before */
+        fresh = 0;
+        for(i = 0; i < FUZZ_MAP; i++){
+            /* Most of the map is untouched; skip it a word at a time */
+            if((i & 7) == 0 && *(uint64_t *)(cov_map + i) == 0){
+                i += 7;
+                continue;
+            }
+            if(cov_map[i] == 0){
+                continue;
+            }
+            if(shared != NULL){
+                shared[i] = shared[i] > BYTE_MASK - cov_map[i] ? BYTE_MASK : shared[i] + cov_map[i];
+            }
+            bucket = cov_map[i] < 4 ? cov_map[i] : (cov_map[i] < 8 ? 4 : (cov_map[i] < 32 ? 8 : 16));
+            if((virgin[i] & bucket) == 0){
+                if(virgin[i] == 0){
+                    edges++;
+                }
+                virgin[i] |= bucket;
+                fresh = 1;
+            }
+        }
+
+        /* Crashes and hangs that took a new path are kept for later */
+        if(fault || !flag_stop){
+            if(fresh){
+                sprintf(filename, "%s%s-%u", prefix, fault ? "crash" : "hang", fault ? crashes : hangs);
+                if((file = fopen(filename, "wb")) == NULL || fwrite(input, length, 1, file) != 1){
+                    perror("fuzz: write");
+                }
+                if(file != NULL){
+                    fclose(file);
+                }
+            }
+            if(fault){
+                crashes++;
+            }else{
+                hangs++;
+            }
+        }
+
+        if(fresh && count < FUZZ_CORPUS && (corpus[count] = malloc(length)) != NULL){
+            memcpy(corpus[count++], input, length);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%u executions in %.2fs (%.0f/s): %u edges, %u in corpus, %u crashes, %u hangs.\n",
+        n, secs, secs > 0 ? n / secs : 0.0, edges, count, crashes, hangs);
+
+    /* Leave the DPU as it was before fuzzing */
+    memcpy(memory, image, MEM_SIZE);
+    dpu_flush();
+    snap.icount = icount;
+    dpu_restore(&snap);
+
+    for(i = 0; i < count; i++){
+        free(corpus[i]);
+    }
+
+done:
+    if(shared != NULL){
+        shmdt(shared);
+    }
+    free(cov_map);
+    cov_map = NULL;
+    memcpy(bus, devices, sizeof(bus));
+    engine_kind = ENGINE_FAST;
+    free(image);
+    free(input);
+    free(virgin);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Null Load/Store:  A device that reads as 0 and takes no notice of 
+ *                   stores.
+ ***********************************************************************/
+uint32_t dpu_nullLoad(uint32_t reg, void * memory){
+    (void)reg;
+    (void)memory;
+
+    return 0;
+}
+
+int dpu_nullStore(uint32_t reg, uint32_t value, void * memory){
+    (void)reg;
+    (void)value;
+    (void)memory;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Fault Load/Store:  A device that stops the program with FAULT_MEM on
+ *                    any access.
+ ***********************************************************************/
+uint32_t dpu_faultLoad(uint32_t reg, void * memory){
+    (void)reg;
+    (void)memory;
+
+    dpu_fault(FAULT_MEM);
+    return 0;
+}
+
+int dpu_faultStore(uint32_t reg, uint32_t value, void * memory){
+    (void)reg;
+    (void)value;
+    (void)memory;
+
+    dpu_fault(FAULT_MEM);
+    return 0;
+}
+
+
+/********************************************************************
+ * Mutate:  Apply a random stack of mutations to input: bit flips, random
+ *          bytes, small additions, boundary values and splices from 
+ *          another input in the corpus.
+ ***********************************************************************/
+void dpu_mutate(unsigned char * input, unsigned int length, unsigned char ** corpus, unsigned int count){
+    static const uint8_t interesting[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+    unsigned int i, n, at, from, size;
+
+    n = 1 + dpu_rand() % FUZZ_STACK;
+    for(i = 0; i < n; i++){
+        at = dpu_rand() % length;
+        switch(dpu_rand() % 5){
+            case 0:
+                input[at] ^= 1 << (dpu_rand() % 8);
+                break;
+            case 1:
+                input[at] = dpu_rand();
+                break;
+            case 2:
+                input[at] += (dpu_rand() % 0x23) - 0x11;
+                break;
+            case 3:
+                input[at] = interesting[dpu_rand() % sizeof(interesting)];
+                break;
+            case 4:
+                from = dpu_rand() % length;
+                size = 1 + dpu_rand() % (length - (at > from ? at : from));
+                memcpy(input + at, corpus[dpu_rand() % count] + from, size);
+                break;
+        }
+    }
+}
+
+
+/********************************************************************
+ * Random:  xorshift64* generator for the fuzzer.
+ ***********************************************************************/
+uint32_t dpu_rand(){
+    fuzz_rng ^= fuzz_rng >> 12;
+    fuzz_rng ^= fuzz_rng << 25;
+    fuzz_rng ^= fuzz_rng >> 27;
+
+    return (fuzz_rng * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+
+/********************************************************************
+ * Record:  Start recording to a file, or stop if already recording.  
+ *          The file begins with a snapshot of the processor and memory;
+ *          from then on only changes made from outside the program are
+ *          written, so recording costs nothing while the program runs.
+ ***********************************************************************/
+int dpu_record(void * memory){
+    struct dpu_state state;
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    uint32_t magic = REC_MAGIC;
+
+    if(rec_file != NULL){
+        dpu_recordEvent(EV_END, 0, 0, NULL);
+        if(fclose(rec_file) == EOF){
+            perror("record: fclose");
+        }
+        rec_file = NULL;
+        printf("Recording stopped at instruction %llu.\n", (unsigned long long)icount);
+        return 0;
+    }
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+
+    if((rec_file = fopen(filename, "wb")) == NULL){
+        sprintf(error, "record: fopen: %s", filename);
+        perror(error);
+        return -1;
+    }
+
+    dpu_save(&state);
+    if(fwrite(&magic, sizeof(magic), 1, rec_file) != 1
+            || fwrite(&state, sizeof(state), 1, rec_file) != 1
+            || fwrite(memory, MEM_SIZE, 1, rec_file) != 1){
+        perror("record: fwrite");
+        fclose(rec_file);
+        rec_file = NULL;
+        return -1;
+    }
+
+    recording = 1;
+    printf("Recording to %s.\n", filename);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Record Event:  Write an event to the recording, if there is one, and
+ *                to the history, if kept.  Events of threads other than
+ *                the one recorded are left out.
+ ***********************************************************************/
+void dpu_recordEvent(uint32_t type, uint32_t addr, uint32_t length, const void * data){
+    struct dpu_event event;
+
+    if((rec_file == NULL && history == NULL) || !recording){
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.icount = icount;
+    event.type = type;
+    event.addr = addr;
+    event.length = length;
+
+    if(history != NULL){
+        dpu_historyEvent(&event, data);
+    }
+    if(rec_file == NULL){
+        return;
+    }
+
+    if(fwrite(&event, sizeof(event), 1, rec_file) != 1
+            || (length > 0 && fwrite(data, length, 1, rec_file) != 1)){
+        perror("record: fwrite");
+    }
+}
+
+
+/********************************************************************
+ * Replay:  Load a recording and run it to an instruction count, leaving 
+ *          the processor and memory as they were at that point of the 
+ *          recorded run.  A blank filename goes on with the recording
+ *          already loaded, keeping its checkpoints, so seeking back and
+ *          forth through one recording is cheap.
+ ***********************************************************************/
+int dpu_replay(void * memory){
+    unsigned char filename[BUFF_SIZE];
+    unsigned char flush[BUFF_SIZE];
+    unsigned long long target;
+    struct dpu_replay * rp;
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+
+    if(filename[0] != '\0' && (replay == NULL || strcmp(filename, replay->filename) != 0)){
+        if((rp = dpu_replayLoad(filename)) == NULL){
+            return -1;
+        }
+        dpu_replayFree(replay);
+        replay = rp;
+    }else if(replay == NULL){
+        printf("No recording is loaded.\n");
+        return -1;
+    }
+
+    printf("Enter instruction count (0 for the end):\t");
+    if(scanf("%llu", &target) == 0){
+        printf("Not a valid count.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    if(target == 0 && replay->count > 0){
+        target = replay->events[replay->count - 1].icount;
+    }
+
+    dpu_replaySeek(replay, memory, target);
+    printf("Replayed to instruction %llu.\n", (unsigned long long)icount);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Replay Load:  Read a recording into memory.  Returns NULL if the file
+ *               cannot be read, is not a recording or does not fit in
+ *               memory.
+ ***********************************************************************/
+struct dpu_replay * dpu_replayLoad(const unsigned char * filename){
+    FILE * file;
+    struct dpu_replay * rp;
+    struct dpu_event event;
+    struct dpu_event * events;
+    unsigned char ** data;
+    unsigned char error[BUFF_SIZE];
+    unsigned int size = 0;
+    uint32_t magic;
+
+    if((file = fopen(filename, "rb")) == NULL){
+        sprintf(error, "replay: fopen: %s", filename);
+        perror(error);
+        return NULL;
+    }
+    if((rp = calloc(1, sizeof(struct dpu_replay))) == NULL){
+        perror("replay: calloc");
+        fclose(file);
+        return NULL;
+    }
+    strcpy(rp->filename, filename);
+    rp->interval = REPLAY_INTERVAL;
+
+    if(fread(&magic, sizeof(magic), 1, file) != 1 || magic != REC_MAGIC
+            || fread(&rp->start.state, sizeof(struct dpu_state), 1, file) != 1
+            || fread(rp->start.memory, MEM_SIZE, 1, file) != 1){
+        printf("replay: %s is not a recording.\n", filename);
+        fclose(file);
+        free(rp);
+        return NULL;
+    }
+
+    while(fread(&event, sizeof(event), 1, file) == 1){
+        if(rp->count == size){
+            size = size ? size * 2 : 0x10;
+            if((events = realloc(rp->events, size * sizeof(struct dpu_event))) != NULL){
+                rp->events = events;
+            }
+            if((data = realloc(rp->data, size * sizeof(unsigned char *))) != NULL){
+                rp->data = data;
+            }
+            if(events == NULL || data == NULL){
+                perror("replay: realloc");
+                fclose(file);
+                dpu_replayFree(rp);
+                return NULL;
+            }
+        }
+        rp->data[rp->count] = NULL;
+        if(event.length > 0){
+            if(event.length > MEM_SIZE || (rp->data[rp->count] = malloc(event.length)) == NULL
+                    || fread(rp->data[rp->count], event.length, 1, file) != 1){
+                printf("replay: %s is truncated.\n", filename);
+                free(rp->data[rp->count]);
+                break;
+            }
+        }
+        rp->events[rp->count++] = event;
+    }
+
+    fclose(file);
+
+    return rp;
+}
+
+
+/********************************************************************
+ * Replay Free:  Release a loaded recording and its checkpoints.
+ ***********************************************************************/
+void dpu_replayFree(struct dpu_replay * rp){
+    unsigned int i;
+
+    if(rp == NULL){
+        return;
+    }
+    for(i = 0; i < rp->count; i++){
+        free(rp->data[i]);
+    }
+    for(i = 0; i < rp->npoints; i++){
+        free(rp->points[i]);
+    }
+    free(rp->events);
+    free(rp->data);
+    free(rp);
+}
+
+
+/********************************************************************
+ * Replay Seek:  Bring the processor and memory to instruction target of
+ *               the recording.  The run starts from the latest checkpoint
+ *               at or before target and applies each event once the 
+ *               instruction count reaches it.  Going past the last 
+ *               checkpoint lays down new ones every interval.  Devices 
+ *               are left alone; what they gave the program is taken
+ *               from the recording.
+ ***********************************************************************/
+void dpu_replaySeek(struct dpu_replay * rp, void * memory, uint64_t target){
+    struct dpu_checkpoint * from = &rp->start;
+    uint64_t next, mark;
+    unsigned int i, ev;
+
+    for(i = 0; i < rp->npoints && rp->points[i]->state.icount <= target; i++){
+        from = rp->points[i];
+    }
+
+    engine_kind = ENGINE_FAST;
+    dpu_restore(&from->state);
+    memcpy(memory, from->memory, MEM_SIZE);
+    dpu_flush();
+    ev = from->event;
+
+    /* Device loads are answered from the recording */
+    rp->device = ev;
+    bus_replay = rp;
+
+    /* Only lay down checkpoints past the last one */
+    mark = rp->npoints ? rp->points[rp->npoints - 1]->state.icount : rp->start.state.icount;
+    if(from->state.icount < mark){
+        mark = NO_LIMIT;
+    }else{
+        mark += rp->interval;
+    }
+
+    forever{
+        ev = dpu_replayEvents(rp, memory, ev);
+
+        if(icount >= target){
+            break;
+        }
+
+        next = target;
+        if(ev < rp->count && rp->events[ev].icount < next){
+            next = rp->events[ev].icount;
+        }
+        if(mark < next){
+            next = mark;
+        }
+
+        dpu_run(memory, next, 1);
+
+        if(icount >= mark){
+            if(rp->npoints == REPLAY_POINTS){
+                for(i = 1; i < REPLAY_POINTS; i += 2){
+                    free(rp->points[i]);
+                    rp->points[i / 2] = rp->points[i - 1];
+                }
+                rp->npoints = REPLAY_POINTS / 2;
+                rp->interval *= 2;
+            }
+            if((rp->points[rp->npoints] = malloc(sizeof(struct dpu_checkpoint))) != NULL){
+                dpu_save(&rp->points[rp->npoints]->state);
+                memcpy(rp->points[rp->npoints]->memory, memory, MEM_SIZE);
+                rp->points[rp->npoints]->event = ev;
+                rp->npoints++;
+            }
+            mark = icount + rp->interval;
+        }
+
+        /* Stopped short of the next event: the recording goes no further */
+        if(flag_stop && icount < next){
+            break;
+        }
+    }
+
+    bus_replay = NULL;
+}
+
+
+/********************************************************************
+ * Replay Events:  Apply the events of a recording from ev that are due
+ *                 at this point.  Returns the next event to apply.
+ ***********************************************************************/
+unsigned int dpu_replayEvents(struct dpu_replay * rp, void * memory, unsigned int ev){
+    struct dpu_event * event;
+
+    while(ev < rp->count && rp->events[ev].icount <= icount){
+        event = &rp->events[ev];
+        if(event->type == EV_MEMORY && event->addr + event->length <= MEM_SIZE){
+            memcpy((unsigned char *)memory + event->addr, rp->data[ev], event->length);
+            dpu_flush();
+        }else if(event->type == EV_RESET){
+            dpu_reset();
+        }
+        ev++;
+    }
+
+    return ev;
+}
+
+
+/********************************************************************
+ * Reverse:  Start or stop keeping history, set the watchpoint, or go 
+ *           back through the history: one instruction, or to the last
+ *           instruction that changed the watched word.
+ ***********************************************************************/
+int dpu_reverse(void * memory){
+    unsigned char choice[BUFF_SIZE];
+    struct dpu_mark * mark;
+    uint64_t now = icount;
+    uint64_t changed = NO_LIMIT;
+    uint64_t end;
+    unsigned int addr, i;
+
+    printf("Enter h to start or stop keeping history, w to set a watchpoint, s to step\n"
+            "back, or c to continue back to the watchpoint:\t");
+    fgets(choice, BUFF_SIZE, stdin);
+    choice[0] = tolower(choice[0]);
+
+    if(choice[0] == 'h' && history == NULL){
+        if((history = calloc(1, sizeof(struct dpu_history))) == NULL
+                || (history->log = calloc(1, sizeof(struct dpu_replay))) == NULL){
+            printf("Not enough memory to keep history.\n");
+            dpu_historyFree();
+            return -1;
+        }
+        if(dpu_historyMark(memory) != 0){
+            return -1;
+        }
+        recording = 1;
+        printf("Keeping history from instruction %llu.\n", (unsigned long long)icount);
+        return 0;
+    }
+    if(history == NULL){
+        printf("History is not being kept.\n");
+        return -1;
+    }
+
+    switch(choice[0]){
+        case 'h':
+            dpu_historyFree();
+            printf("History stopped.\n");
+            break;
+        case 'w':
+            printf("Enter address in hex:\t");
+            if(scanf("%x", &addr) == 0 || addr >= MEM_SIZE){
+                printf("Not a valid address.\n");
+            }else{
+                history->watch = addr & ~(REG_SIZE - 1);
+                history->watching = 1;
+                printf("Watching the word at %08X.\n", history->watch);
+            }
+            fgets(choice, BUFF_SIZE, stdin);
+            break;
+        case 's':
+            if(icount == 0 || dpu_historySeek(memory, icount - 1) != 0){
+                printf("History does not reach back that far.\n");
+                break;
+            }
+            dpu_reg();
+            break;
+        case 'c':
+            if(!history->watching){
+                printf("No watchpoint is set.\n");
+                break;
+            }
+            /* Search each stretch between marks, the latest first */
+            for(i = history->count; i > 0 && changed == NO_LIMIT; i--){
+                mark = &history->marks[(history->first + i - 1) % HISTORY_POINTS];
+                if(mark->state.icount >= now){
+                    continue;
+                }
+                end = now;
+                if(i < history->count && history->marks[(history->first + i) % HISTORY_POINTS].state.icount < end){
+                    end = history->marks[(history->first + i) % HISTORY_POINTS].state.icount;
+                }
+                changed = dpu_historyReplay(memory, i - 1, end, 1);
+            }
+            if(changed == NO_LIMIT){
+                dpu_historySeek(memory, now);
+                printf("The watched word did not change in the history kept.\n");
+                break;
+            }
+            dpu_historySeek(memory, changed);
+            printf("The watched word is changed by the next instruction.\n");
+            dpu_reg();
+            break;
+        default:
+            printf("Not a valid choice.\n");
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Run Marked:  Run as dpu_run() does, until the program stops or the 
+ *              instruction count reaches limit, stopping every so often
+ *              to mark the history, every HISTORY_INTERVAL instructions,
+ *              and to write to the snapshot stream, every interval of
+ *              the stream, whichever are kept.  The run stops at each,
+ *              so translated code is not entered.
+ ***********************************************************************/
+void dpu_runMarked(void * memory, uint64_t limit){
+    uint64_t next, mark = NO_LIMIT;
+
+    while(!flag_stop && icount < limit){
+        next = limit;
+        if(history != NULL){
+            mark = history->marks[(history->first + history->count - 1) % HISTORY_POINTS].state.icount 
+                + HISTORY_INTERVAL;
+            next = mark < next ? mark : next;
+        }
+        if(stream != NULL && stream->next < next){
+            next = stream->next;
+        }
+        dpu_run(memory, next, 0);
+        if(history != NULL && icount >= mark){
+            dpu_historyMark(memory);
+        }
+        if(stream != NULL && icount >= stream->next){
+            dpu_streamWrite(memory);
+        }
+        if(debug.hit){
+            break;
+        }
+    }
+}
+
+
+/********************************************************************
+ * History Mark:  Mark the point the processor is at.  The pages of 
+ *                memory that differ from the newest mark are kept as 
+ *                they were there, so the new mark can be undone back to
+ *                it.  With the ring full, the oldest mark is dropped, 
+ *                and the events before the one left are let go once 
+ *                they make up half of the log.  Out of memory, history
+ *                stops being kept and -1 is returned.
+ ***********************************************************************/
+int dpu_historyMark(void * memory){
+    struct dpu_replay * log = history->log;
+    struct dpu_mark * mark;
+    unsigned char * mem = memory;
+    unsigned int i, n;
+
+    if(history->count == HISTORY_POINTS){
+        history->first = (history->first + 1) % HISTORY_POINTS;
+        history->count--;
+        /* Nothing goes back past the oldest mark, so its pages are not needed */
+        mark = &history->marks[history->first];
+        for(i = 0; i < HISTORY_PAGES; i++){
+            free(mark->pages[i]);
+            mark->pages[i] = NULL;
+        }
+        if((n = mark->event) > log->count / 2){
+            for(i = 0; i < n; i++){
+                free(log->data[i]);
+            }
+            memmove(log->events, log->events + n, (log->count - n) * sizeof(struct dpu_event));
+            memmove(log->data, log->data + n, (log->count - n) * sizeof(unsigned char *));
+            log->count -= n;
+            for(i = 0; i < history->count; i++){
+                history->marks[(history->first + i) % HISTORY_POINTS].event -= n;
+            }
+        }
+    }
+
+    mark = &history->marks[(history->first + history->count) % HISTORY_POINTS];
+    dpu_save(&mark->state);
+    mark->event = log->count;
+    for(i = 0; i < HISTORY_PAGES; i++){
+        mark->pages[i] = NULL;
+        if(history->count == 0 
+                || memcmp(mem + i * CODE_PAGE, history->memory + i * CODE_PAGE, CODE_PAGE) == 0){
+            continue;
+        }
+        if((mark->pages[i] = malloc(CODE_PAGE)) == NULL){
+            perror("history: malloc");
+            printf("History is no longer kept.\n");
+            dpu_historyFree();
+            return -1;
+        }
+        memcpy(mark->pages[i], history->memory + i * CODE_PAGE, CODE_PAGE);
+    }
+    memcpy(history->memory, memory, MEM_SIZE);
+    history->count++;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * History Event:  Add an event from outside the program to the log.
+ *                 Out of memory, history stops being kept and -1 is 
+ *                 returned.
+ ***********************************************************************/
+int dpu_historyEvent(const struct dpu_event * event, const void * data){
+    struct dpu_replay * log = history->log;
+    struct dpu_event * events = log->events;
+    unsigned char ** datas = log->data;
+    unsigned int size;
+
+    if(log->count % 0x10 == 0){
+        size = log->count + 0x10;
+        if((events = realloc(log->events, size * sizeof(struct dpu_event))) != NULL){
+            log->events = events;
+        }
+        if((datas = realloc(log->data, size * sizeof(unsigned char *))) != NULL){
+            log->data = datas;
+        }
+        if(events == NULL || datas == NULL){
+            perror("history: realloc");
+            printf("History is no longer kept.\n");
+            dpu_historyFree();
+            return -1;
+        }
+    }
+    log->data[log->count] = NULL;
+    if(event->length > 0){
+        if((log->data[log->count] = malloc(event->length)) == NULL){
+            perror("history: malloc");
+            printf("History is no longer kept.\n");
+            dpu_historyFree();
+            return -1;
+        }
+        memcpy(log->data[log->count], data, event->length);
+    }
+    log->events[log->count++] = *event;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * History Free:  Stop keeping history, releasing the marks and the log.
+ ***********************************************************************/
+void dpu_historyFree(){
+    unsigned int i, k;
+
+    if(history == NULL){
+        return;
+    }
+    for(k = 0; k < HISTORY_POINTS; k++){
+        for(i = 0; i < HISTORY_PAGES; i++){
+            free(history->marks[k].pages[i]);
+        }
+    }
+    dpu_replayFree(history->log);
+    free(history);
+    history = NULL;
+}
+
+
+/********************************************************************
+ * History Seek:  Bring the processor and memory back to instruction 
+ *                target, from the latest mark at or before it.  The 
+ *                marks and events after target are let go, as running 
+ *                on from there makes a new history.  Returns -1 if the
+ *                history does not reach back to target.
+ ***********************************************************************/
+int dpu_historySeek(void * memory, uint64_t target){
+    struct dpu_replay * log = history->log;
+    struct dpu_mark * mark;
+    unsigned int i, k;
+
+    for(k = history->count; k > 0; k--){
+        if(history->marks[(history->first + k - 1) % HISTORY_POINTS].state.icount <= target){
+            break;
+        }
+    }
+    if(k == 0){
+        return -1;
+    }
+
+    dpu_historyReplay(memory, k - 1, target, 0);
+
+    while(history->count > k){
+        mark = &history->marks[(history->first + history->count - 1) % HISTORY_POINTS];
+        for(i = 0; i < HISTORY_PAGES; i++){
+            if(mark->pages[i] != NULL){
+                memcpy(history->memory + i * CODE_PAGE, mark->pages[i], CODE_PAGE);
+                free(mark->pages[i]);
+                mark->pages[i] = NULL;
+            }
+        }
+        history->count--;
+    }
+    for(i = history->next; i < log->count; i++){
+        free(log->data[i]);
+    }
+    log->count = history->next;
+
+    return 0;
+}
+
+
+/********************************************************************
+ * History Replay:  Restore mark index, counting from the oldest, and 
+ *                  run from it to instruction target.  Devices are left
+ *                  alone, and what came from outside the program is 
+ *                  taken from the log, as when replaying a recording.
+ *                  If watching, the run goes one instruction at a time
+ *                  and returns the instruction count the last change to
+ *                  the watched word was made at, or NO_LIMIT if it did
+ *                  not change.
+ ***********************************************************************/
+uint64_t dpu_historyReplay(void * memory, unsigned int index, uint64_t target, uint8_t watching){
+    struct dpu_mark * mark = &history->marks[(history->first + index) % HISTORY_POINTS];
+    struct dpu_replay * log = history->log;
+    unsigned char * mem = memory;
+    unsigned char * undo;
+    uint64_t next, at;
+    uint64_t changed = NO_LIMIT;
+    uint32_t before, after;
+    unsigned int i, k, ev;
+
+    /* Undo the marks after this one, the newest first */
+    memcpy(memory, history->memory, MEM_SIZE);
+    for(k = history->count - 1; k > index; k--){
+        for(i = 0; i < HISTORY_PAGES; i++){
+            if((undo = history->marks[(history->first + k) % HISTORY_POINTS].pages[i]) != NULL){
+                memcpy(mem + i * CODE_PAGE, undo, CODE_PAGE);
+            }
+        }
+    }
+
+    engine_kind = ENGINE_FAST;
+    dpu_restore(&mark->state);
+    dpu_flush();
+    ev = mark->event;
+    log->device = ev;
+    bus_replay = log;
+
+    forever{
+        ev = dpu_replayEvents(log, memory, ev);
+
+        if(icount >= target){
+            break;
+        }
+
+        next = target;
+        if(ev < log->count && log->events[ev].icount < next){
+            next = log->events[ev].icount;
+        }
+
+        if(!watching){
+            dpu_run(memory, next, 1);
+        }
+        while(watching && !flag_stop && icount < next){
+            memcpy(&before, mem + history->watch, sizeof(before));
+            at = icount;
+            if(icount >= alarm_next){
+                dpu_alarms(memory);
+            }
+            dpu_instCycle(memory);
+            memcpy(&after, mem + history->watch, sizeof(after));
+            if(before != after){
+                changed = at;
+            }
+        }
+
+        if(flag_stop && icount < next){
+            break;
+        }
+    }
+
+    bus_replay = NULL;
+    history->next = ev;
+
+    return changed;
+}
+
+
+/********************************************************************
+ * Stream:  Start or stop writing a snapshot stream, or load a snapshot
+ *          from one.  The packing is checked before a stream is opened,
+ *          so a stream is never written or read with a packing that 
+ *          does not give back what it was given.
+ ***********************************************************************/
+int dpu_stream(void * memory){
+    unsigned char choice[BUFF_SIZE];
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    unsigned long long interval;
+
+    printf("Enter s to start or stop writing a snapshot stream, or l to load a\n"
+            "snapshot from one:\t");
+    fgets(choice, BUFF_SIZE, stdin);
+
+    switch(tolower(choice[0])){
+        case 's':
+            if(stream != NULL){
+                dpu_streamStop(memory);
+                break;
+            }
+            if(dpu_packCheck() != 0){
+                return -1;
+            }
+            printf("Enter instructions between snapshots:\t");
+            if(scanf("%llu", &interval) == 0 || interval == 0){
+                printf("Not a valid count.\n");
+                fgets(choice, BUFF_SIZE, stdin);
+                return -1;
+            }
+            fgets(choice, BUFF_SIZE, stdin);
+            printf("\nEnter a filename: ");
+            fgets(filename, BUFF_SIZE, stdin);
+            filename[strlen(filename) - 1] = '\0';
+
+            if((stream = calloc(1, sizeof(struct dpu_stream))) == NULL){
+                printf("Not enough memory to write a stream.\n");
+                return -1;
+            }
+            if((stream->file = fopen(filename, "wb")) == NULL){
+                sprintf(error, "stream: fopen: %s", filename);
+                perror(error);
+                free(stream);
+                stream = NULL;
+                return -1;
+            }
+            stream->interval = interval;
+
+            /* The base is a delta from all zeros */
+            if(dpu_streamWrite(memory) != 0){
+                dpu_streamStop(memory);
+                return -1;
+            }
+            printf("Writing snapshots to %s.\n", filename);
+            break;
+        case 'l':
+            if(dpu_packCheck() != 0){
+                return -1;
+            }
+            return dpu_streamLoad(memory);
+        default:
+            printf("Not a valid choice.\n");
+    }
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Stream Write:  Append a snapshot of the processor and memory to the
+ *                stream, as a packed delta from the last one.  Returns
+ *                -1 if it could not be written.
+ ***********************************************************************/
+int dpu_streamWrite(void * memory){
+    struct dpu_snap snap;
+    struct dpu_state state;
+    unsigned char * mem = memory;
+    unsigned char * delta;
+    unsigned char * packed;
+    unsigned char * from;
+    size_t length = sizeof(struct dpu_state);
+    unsigned int i, j;
+    int failed = 0;
+
+    delta = malloc(SNAP_DELTA);
+    packed = malloc(2 * SNAP_DELTA);
+    if(delta == NULL || packed == NULL){
+        perror("stream: malloc");
+        free(delta);
+        free(packed);
+        return -1;
+    }
+
+    /* Padding is zeroed so it never differs */
+    memset(&state, 0, sizeof(state));
+    dpu_save(&state);
+    from = (unsigned char *)&stream->state;
+    for(i = 0; i < sizeof(state); i++){
+        delta[i] = ((unsigned char *)&state)[i] ^ from[i];
+    }
+
+    memset(&snap, 0, sizeof(snap));
+    for(i = 0; i < SNAP_PAGES; i++){
+        from = stream->memory + i * CODE_PAGE;
+        if(memcmp(mem + i * CODE_PAGE, from, CODE_PAGE) == 0){
+            continue;
+        }
+        for(j = 0; j < CODE_PAGE; j++){
+            delta[length++] = mem[i * CODE_PAGE + j] ^ from[j];
+        }
+        snap.pages |= 1U << i;
+    }
+
+    snap.magic = SNAP_MAGIC;
+    snap.icount = icount;
+    snap.length = dpu_pack(delta, length, packed);
+    if(fwrite(&snap, sizeof(snap), 1, stream->file) != 1 
+            || fwrite(packed, snap.length, 1, stream->file) != 1){
+        perror("stream: fwrite");
+        failed = 1;
+    }else{
+        stream->state = state;
+        memcpy(stream->memory, memory, MEM_SIZE);
+        stream->count++;
+    }
+    stream->next = icount + stream->interval;
+
+    free(delta);
+    free(packed);
+
+    return failed ? -1 : 0;
+}
+
+
+/********************************************************************
+ * Stream Stop:  Write a last snapshot, if the processor has moved on
+ *               since the one before, and close the stream.
+ ***********************************************************************/
+void dpu_streamStop(void * memory){
+    if(stream == NULL){
+        return;
+    }
+    if(stream->count > 0 && icount != stream->state.icount){
+        dpu_streamWrite(memory);
+    }
+    if(fclose(stream->file) == EOF){
+        perror("stream: fclose");
+    }
+    printf("Snapshot stream stopped after %u snapshots.\n", stream->count);
+    free(stream);
+    stream = NULL;
+}
+
+
+/********************************************************************
+ * Stream Load:  Restore the processor and memory from a snapshot of a
+ *               stream, by applying the deltas in order up to it.  A 
+ *               number past the end restores the last snapshot.  Any
+ *               history kept is dropped.
+ ***********************************************************************/
+int dpu_streamLoad(void * memory){
+    FILE * file;
+    struct dpu_snap snap;
+    struct dpu_state state;
+    unsigned char filename[BUFF_SIZE];
+    unsigned char error[BUFF_SIZE];
+    unsigned char flush[BUFF_SIZE];
+    unsigned char image[MEM_SIZE];
+    unsigned char * delta;
+    unsigned char * packed;
+    unsigned char * to;
+    size_t length;
+    unsigned int target, count, i, j;
+
+    printf("\nEnter a filename: ");
+    fgets(filename, BUFF_SIZE, stdin);
+    filename[strlen(filename) - 1] = '\0';
+    printf("Enter snapshot number (0 for the base):\t");
+    if(scanf("%u", &target) == 0){
+        printf("Not a valid number.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    if((file = fopen(filename, "rb")) == NULL){
+        sprintf(error, "stream: fopen: %s", filename);
+        perror(error);
+        return -1;
+    }
+    delta = malloc(SNAP_DELTA);
+    packed = malloc(2 * SNAP_DELTA);
+    if(delta == NULL || packed == NULL){
+        perror("stream: malloc");
+        free(delta);
+        free(packed);
+        fclose(file);
+        return -1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    memset(image, 0, MEM_SIZE);
+    for(count = 0; count <= target && fread(&snap, sizeof(snap), 1, file) == 1; count++){
+        for(i = 0, length = sizeof(state); i < SNAP_PAGES; i++){
+            length += snap.pages >> i & 1 ? CODE_PAGE : 0;
+        }
+        if(snap.magic != SNAP_MAGIC || snap.length > 2 * SNAP_DELTA
+                || fread(packed, snap.length, 1, file) != 1
+                || dpu_unpack(packed, snap.length, delta, length) != 0){
+            printf("stream: %s is not a snapshot stream past snapshot %u.\n", filename, count);
+            break;
+        }
+
+        to = (unsigned char *)&state;
+        for(i = 0; i < sizeof(state); i++){
+            to[i] ^= delta[i];
+        }
+        for(i = 0, length = sizeof(state); i < SNAP_PAGES; i++){
+            if((snap.pages >> i & 1) == 0){
+                continue;
+            }
+            for(j = 0; j < CODE_PAGE; j++){
+                image[i * CODE_PAGE + j] ^= delta[length++];
+            }
+        }
+    }
+    fclose(file);
+    free(delta);
+    free(packed);
+
+    if(count == 0){
+        printf("stream: %s holds no snapshots.\n", filename);
+        return -1;
+    }
+
+    dpu_historyFree();
+    memcpy(memory, image, MEM_SIZE);
+    dpu_flush();
+    dpu_restore(&state);
+    dpu_recordEvent(EV_MEMORY, 0, MEM_SIZE, memory);
+    printf("Restored snapshot %u, at instruction %llu.\n", count - 1, (unsigned long long)icount);
+
+    return 0;
+}
+
+
+/********************************************************************
+ * Pack:  Pack length bytes of in into out, as runs of zeros each 
+ *        followed by literals.  out must have room for twice length.
+ *        Returns the bytes packed into.
+ ***********************************************************************/
+size_t dpu_pack(const unsigned char * in, size_t length, unsigned char * out){
+    size_t i = 0, o = 0, zeros, start;
+    uint32_t word;
+
+    while(i < length){
+        for(zeros = 0; i < length && in[i] == 0 && zeros < PACK_MOST; i++, zeros++);
+        for(start = i; i < length && i - start < PACK_MOST; i++){
+            if(in[i] == 0 && i + PACK_RUN <= length){
+                memcpy(&word, in + i, PACK_RUN);
+                if(word == 0){
+                    break;
+                }
+            }
+        }
+        out[o++] = zeros;
+        out[o++] = zeros >> SHIFT_BYTE;
+        out[o++] = i - start;
+        out[o++] = (i - start) >> SHIFT_BYTE;
+        memcpy(out + o, in + start, i - start);
+        o += i - start;
+    }
+
+    return o;
+}
+
+
+/********************************************************************
+ * Unpack:  Unpack length bytes of in, packed by dpu_pack(), into the
+ *          size bytes of out.  Returns -1 if they do not unpack to 
+ *          exactly size bytes.
+ ***********************************************************************/
+int dpu_unpack(const unsigned char * in, size_t length, unsigned char * out, size_t size){
+    size_t i = 0, o = 0, zeros, literals;
+
+    while(i + 4 <= length){
+        zeros = in[i] | in[i + 1] << SHIFT_BYTE;
+        literals = in[i + 2] | in[i + 3] << SHIFT_BYTE;
+        i += 4;
+        if(o + zeros + literals > size || i + literals > length){
+            return -1;
+        }
+        memset(out + o, 0, zeros);
+        memcpy(out + o + zeros, in + i, literals);
+        o += zeros + literals;
+        i += literals;
+    }
+
+    return i == length && o == size ? 0 : -1;
+}
+
+
+/********************************************************************
+ * Pack Check:  Pack and unpack all zeros, all literals, alternating 
+ *              bytes and alternating runs of PACK_RUN, and see that each
+ *              comes back as it was.  Returns -1 if one does not.
+ ***********************************************************************/
+int dpu_packCheck(){
+    unsigned char * in = malloc(PACK_CHECK);
+    unsigned char * packed = malloc(2 * PACK_CHECK);
+    unsigned char * out = malloc(PACK_CHECK);
+    unsigned int kind, i;
+    int result = 0;
+
+    if(in == NULL || packed == NULL || out == NULL){
+        perror("pack: malloc");
+        result = -1;
+    }
+    for(kind = 0; result == 0 && kind < 4; kind++){
+        for(i = 0; i < PACK_CHECK; i++){
+            in[i] = kind == 0 ? 0 : kind == 1 ? i % BYTE_MASK + 1 
+                : kind == 2 ? (i & 1) * (i % BYTE_MASK | 1) : (i / PACK_RUN & 1) * (i % BYTE_MASK | 1);
+        }
+        if(dpu_unpack(packed, dpu_pack(in, PACK_CHECK, packed), out, PACK_CHECK) != 0
+                || memcmp(in, out, PACK_CHECK) != 0){
+            printf("pack: pattern %u does not unpack as it was packed.\n", kind);
+            result = -1;
+        }
+    }
+
+    free(in);
+    free(packed);
+    free(out);
+
+    return result;
+}
+
+
+/**
+ *  Save: Copy all registers and flags into state.
+ */
+void dpu_save(struct dpu_state * state){
+    memcpy(state->regfile, regfile, sizeof(regfile));
+    state->mar = mar;
+    state->mbr = mbr;
+    state->ir = ir;
+    state->alu = alu;
+    state->cir = cir;
+    state->flag_sign = flag_sign;
+    state->flag_zero = flag_zero;
+    state->flag_carry = flag_carry;
+    state->flag_stop = flag_stop;
+    state->flag_ir = flag_ir;
+    state->fault = fault;
+    state->icount = icount;
+    memcpy(state->alarms, alarms, sizeof(alarms));
+    state->alarm_count = alarm_count;
+    state->timer_period = timer_period;
+    state->timer_vector = timer_vector;
+    state->mmu_on = mmu_on;
+    state->mmu_table = mmu_table;
+    state->mmu_fault = mmu_fault;
+    state->flag_irq = flag_irq;
+    state->irq_pending = irq_pending;
+}
+
+
+/**
+ *  Restore: Load all registers and flags from state.  What was counted
+ *           before is tallied first, as the instruction count jumps.
+ */
+void dpu_restore(const struct dpu_state * state){
+    dpu_tally();
+    memcpy(regfile, state->regfile, sizeof(regfile));
+    mar = state->mar;
+    mbr = state->mbr;
+    ir = state->ir;
+    alu = state->alu;
+    cir = state->cir;
+    flag_sign = state->flag_sign;
+    flag_zero = state->flag_zero;
+    flag_carry = state->flag_carry;
+    flag_stop = state->flag_stop;
+    flag_ir = state->flag_ir;
+    fault = state->fault;
+    icount = state->icount;
+    memcpy(alarms, state->alarms, sizeof(alarms));
+    alarm_count = state->alarm_count;
+    timer_period = state->timer_period;
+    timer_vector = state->timer_vector;
+    flag_irq = state->flag_irq;
+    irq_pending = state->irq_pending;
+    mmu_on = state->mmu_on;
+    mmu_table = state->mmu_table;
+    mmu_fault = state->mmu_fault;
+    dpu_mmuFlush();
+    dpu_alarmNext();
+    reserved = 0;
+    tally_icount = icount;
+    tally_next = icount + TALLY_INTERVAL;
+}
+
+
+/**
+ * Help:  Function to print DPU options to the user
+ *	      in the form of a menu.
+ */
+void dpu_help(){
+    printf("\ta\tattach a translated image\n"
+            "\tb\tattach a file as the disk\n"
+            "\tc\tcompile - translate the program to C\n"
+            "\td\tdump memory\n"
+            "\te\trecord - start or stop recording\n"
+            "\tf\tfuzz an input region of memory\n"
+            "\tg\tgo - run the entire program\n"
+            "\ti\tinstruction pairs - run, counting the pairs run\n"
+            "\tk\tcache - run, simulating the caches\n"
+            "\tl\tload a file into memory\n"
+            "\tm\tmemory modify\n"
+            "\tn\tsnapshots - write a snapshot stream, or load from one\n"
+            "\to\tmetrics - start or stop writing counters to a file\n"
+            "\tp\tpool - run many guests on a few threads\n"
+            "\tq\tquit\n"
+            "\tr\tdisplay registers\n"
+            "\ts\tsmp - run the program on several cores\n"
+            "\tt\ttrace - execute one instruction\n"
+            "\tu\tundo - keep history and step back through it\n"
+            "\tv\tvector - run the program in lockstep lanes\n"
+            "\tw\twrite file\n"
+            "\tx\tdebug - breakpoints, tracing, profiling and sampling\n"
+            "\ty\treplay a recording to an instruction count\n"
+            "\tz\treset all registers to zero\n"
+            "\t?, h\tdisplay list of commands\n");
+}
+
+
+/********************************************************************
+ * Instruction Cycle:   
+ *      An instruction cycle consists of a fetch, which provides two 
+ *      instructions, and an execute for each of said instructions.  
+ *      An IR flag is uses to determine the which instruction is to be
+ *      executed from either 16-bit IR0 or IR1 of the 32-bit 
+ *      Instruction Register.  If the flag is high, IR1 will be executed,
+ *      then the flag will be set low.  If the flag is low, a fetch is made,
+ *      providing IR0 and IR1 with the new instructions, and the flag is 
+ *      then set high.  
+ *
+ ***********************************************************************/
+void dpu_instCycle(void * memory){
+    uint8_t before = fault;
+
+    /* Determine which IR to use via IR Active flag */
+    if(flag_ir == 0){
+        /* A handler returning from an interrupt */
+        if(PC == IRQ_RETURN && flag_irq){
+            dpu_irqReturn(memory);
+            return;
+        }
+        flag_ir = 1;
+        /* Fetch new set of instructions.  Only a fault of this fetch, 
+         * not one left from before, keeps IR0 from running. */
+        engines[engine_kind].fetch(memory);
+        if(fault != before){
+            return;
+        }
+        /* Current instruction is now IR0 */
+        cir = IR0;
+        engines[engine_kind].execute(memory);
+    }else{
+        flag_ir = 0;
+        cir = IR1;
+        engines[engine_kind].execute(memory);
+    }     
+}
+
+
+/********************************************************************
+ * Run:  Execute the program until it stops, or until the instruction
+ *       count reaches limit, a block at a time.  The run stops at the 
+ *       limit exactly if exact is set, or else at the end of the block
+ *       that reaches it.  Each block is decoded once and then run straight from its saved 
+ *       instruction pairs.  Where a block ends, the next is found through
+ *       the links left by earlier runs, or through the shadow return 
+ *       stack for a PUL-return, before falling back to a lookup.  A 
+ *       pending IR1, or code that cannot be held in a block, goes through 
+ *       the ordinary instruction cycle.  On a core of a multi-core run, 
+ *       the blocks are thrown away whenever another core stores into 
+ *       code.  Alarms are looked at between blocks.  A block that loops
+ *       on itself is checked for being an idle loop, which is then 
+ *       skipped ahead.  The run uses the engine of engine_kind; under 
+ *       the debug engine, it also stops at breakpoints.  Under the debug
+ *       and cache engines, idle loops and translated code are left alone
+ *       so every instruction is seen.  With the MMU on, blocks are found
+ *       by the address the PC maps to, and are not chained, as the same
+ *       code may be mapped at another address by the next table.  Pages
+ *       dropped by stores are freed whenever no block is running, so a
+ *       program that keeps storing into its own code does not grow.
+ ***********************************************************************/
+void dpu_run(void * memory, uint64_t limit, uint8_t exact){
+    void (*run_block)(struct dpu_block * block, void * memory) = engines[engine_kind].runBlock;
+    uint8_t debugging = engine_kind == ENGINE_DEBUG;
+    uint8_t every = debugging || engine_kind == ENGINE_CACHE;
+    struct dpu_block * block = NULL;
+    struct dpu_block * last = NULL;
+    struct dpu_block * next;
+    uint32_t pc;
+
+    ras_count = 0;
+    aot_valid = aot_image != NULL && limit == NO_LIMIT && smp_cores == 0 && !every
+        && dpu_aotCheck(memory);
+
+    while(!flag_stop && icount < limit){
+        /* Alarms due, and interrupts waiting to be taken */
+        if(icount >= alarm_next){
+            dpu_alarms(memory);
+            block = NULL;
+        }
+        if(icount >= tally_next){
+            dpu_tally();
+        }
+        /* Another core stored into code: start over with no blocks */
+        if(smp_cores != 0 && core_epoch != __atomic_load_n(&code_epoch, __ATOMIC_ACQUIRE)){
+            core_epoch = __atomic_load_n(&code_epoch, __ATOMIC_ACQUIRE);
+            dpu_flush();
+            block = NULL;
+        }
+        /* Blocks look for breakpoints themselves */
+        if(debugging && block == NULL && flag_ir == 0 && dpu_breakAt(PC)){
+            break;
+        }
+        /* Close to the limit or an alarm, go one instruction at a time */
+        if((exact && limit - icount < RUN_SLACK) || alarm_next < icount + RUN_SLACK){
+            dpu_instCycle(memory);
+            block = NULL;
+            continue;
+        }
+        /* Translated code takes over wherever it can be entered */
+        if(aot_valid && !mmu_on && flag_ir == 0 && alarm_next == NO_LIMIT && PC < MEM_SIZE && aot_map[PC]){
+            dpu_aot(memory);
+            block = NULL;
+            continue;
+        }
+        if(block == NULL){
+            /* No block is running, so pages dropped by stores can go */
+            if(retired != NULL || dropped_count > 0){
+                dpu_reclaim();
+            }
+            /* Blocks are kept by the address the code is at */
+            pc = PC;
+            if(mmu_on && flag_ir == 0){
+                pc = MMU_MAP(PC, tlb_exec, MMU_EXEC, memory);
+            }
+            if(flag_ir == 0 && pc <= MEM_SIZE - REG_SIZE){
+                block = dpu_lookup(pc, memory);
+            }
+            if(block == NULL){
+                dpu_instCycle(memory);
+                continue;
+            }
+            last = NULL;
+        }
+        if(block == last && __atomic_load_n(&block->idle, __ATOMIC_RELAXED) > 0 && !every && !mmu_on){
+            next = dpu_idle(block, memory, limit);
+        }else{
+            run_block(block, memory);
+            if(debug.hit){
+                break;
+            }
+            next = dpu_chain(block, memory);
+        }
+        last = block;
+        block = next;
+    }
+
+    ras_count = 0;
+    dpu_reclaim();
+    dpu_tally();
+}
+
+
+/********************************************************************
+ * Lookup:  Find the block starting at pc, decoding it if it has not 
+ *          been seen.  Returns NULL if the first pair at pc does not fit
+ *          in the code page.  A page not yet decoded is taken from the
+ *          common page cache on threads that share pages, unless the 
+ *          program has stored into it.  Blocks of a common page are 
+ *          decoded from the page's bytes, and put in the page unless
+ *          another thread got there first.  On a multi-core run, NULL is
+ *          also returned if another core changed the bytes of the block
+ *          as it was decoded.
+ ***********************************************************************/
+struct dpu_block * dpu_lookup(uint32_t pc, void * memory){
+    struct dpu_page * page;
+    struct dpu_block * block;
+    struct dpu_block * found = NULL;
+    const unsigned char * mem;
+    uint32_t index = pc >> PAGE_SHIFT;
+    uint32_t base = index << PAGE_SHIFT;
+    uint32_t addr, word, end;
+
+    if((page = code_pages[index]) == NULL){
+        if(code_common && !code_written[index]){
+            page = dpu_pageJoin(index, memory);
+        }else if((page = calloc(1, sizeof(struct dpu_page))) != NULL){
+            page->lo = MAX32;
+        }
+        if(page == NULL){
+            return NULL;
+        }
+        code_pages[index] = page;
+    }
+    if((block = __atomic_load_n(&page->blocks[pc & PAGE_MASK], __ATOMIC_ACQUIRE)) != NULL){
+        return block;
+    }
+    mem = page->bytes != NULL ? page->bytes : (const unsigned char *)memory + base;
+
+    if((block = calloc(1, sizeof(struct dpu_block))) == NULL){
+        return NULL;
+    }
+    block->start = pc;
+    block->page = page;
+
+    /* Take pairs until one changes the flow or the page runs out */
+    for(addr = pc; block->words < BLOCK_WORDS; addr += REG_SIZE){
+        if((addr + REG_SIZE - 1) >> PAGE_SHIFT != pc >> PAGE_SHIFT){
+            break;
+        }
+        word = (uint32_t)mem[addr - base] << SHIFT_3BYTE | mem[addr - base + 1] << SHIFT_2BYTE
+            | mem[addr - base + 2] << SHIFT_BYTE | mem[addr - base + 3];
+        block->fuse[block->words] = dpu_fuse(word);
+        block->ir[block->words++] = word;
+        if(dpu_endsBlock(word >> SHIFT_2BYTE) || dpu_endsBlock(word & 0xFFFF)){
+            break;
+        }
+    }
+
+    if(block->words == 0){
+        free(block);
+        return NULL;
+    }
+    block->idle = IDLE_TRIES;
+    for(addr = 0; addr < block->words; addr++){
+        if(dpu_sideEffect(block->ir[addr] >> SHIFT_2BYTE) 
+                || dpu_sideEffect(block->ir[addr] & 0xFFFF)){
+            block->idle = 0;
+        }
+    }
+
+    /* On a multi-core run the bytes may be changing under the block.  A
+     * common page that no longer matches memory is dropped, so that the
+     * next lookup decodes from memory itself. */
+    if(smp_cores != 0 && !dpu_claim(block, memory)){
+        free(block);
+        if(page->bytes != NULL){
+            dpu_invalidate(pc);
+        }
+        return NULL;
+    }
+    if(page->bytes != NULL){
+        if(!__atomic_compare_exchange_n(&page->blocks[pc & PAGE_MASK], &found, block, 0, 
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            free(block);
+            return found;
+        }
+        return block;
+    }
+    page->blocks[pc & PAGE_MASK] = block;
+
+    /* Keep the bytes newly covered, as decoded */
+    end = pc + block->words * REG_SIZE;
+    if(page->lo > page->hi){
+        page->lo = page->hi = pc;
+    }
+    if(pc < page->lo){
+        memcpy(page->copy + (pc - base), mem + (pc - base), page->lo - pc);
+        page->lo = pc;
+    }
+    if(end > page->hi){
+        memcpy(page->copy + (page->hi - base), mem + (page->hi - base), end - page->hi);
+        page->hi = end;
+    }
+
+    return block;
+}
+
+
+/********************************************************************
+ * Chain:  Pick the block to run after the one just run.  The last
+ *         instruction run is still in cir.  A BL pushes its return onto 
+ *         the shadow stack, and a PUL-return matching the top of the 
+ *         stack goes to the caller's return block.  Otherwise the links
+ *         of the block are tried, and a lookup made on a miss patches a 
+ *         link for next time.  Returns NULL when the run loop must find
+ *         its own way, as it always must with the MMU on.
+ ***********************************************************************/
+struct dpu_block * dpu_chain(struct dpu_block * block, void * memory){
+    struct dpu_block * next;
+    struct dpu_ras * entry;
+
+    if(flag_stop || flag_ir || mmu_on || PC > MEM_SIZE - REG_SIZE){
+        return NULL;
+    }
+    /* The block's page was thrown away while it ran */
+    if(block->page != code_pages[block->start >> PAGE_SHIFT]){
+        return NULL;
+    }
+
+    if((BRANCH) && LINK_BIT){
+        ras[ras_top].pc = LR;
+        ras[ras_top].caller = block;
+        ras_top = (ras_top + 1) & RAS_MASK;
+        if(ras_count < RAS_SIZE){
+            ras_count++;
+        }
+    }else if((PUSH_PULL) && LOAD_BIT && RET_BIT && ras_count > 0){
+        ras_top = (ras_top - 1) & RAS_MASK;
+        ras_count--;
+        entry = &ras[ras_top];
+        if(entry->pc == PC){
+            next = __atomic_load_n(&entry->caller->ret, __ATOMIC_ACQUIRE);
+            if(next != NULL && next->start == PC){
+                return next;
+            }
+            next = dpu_lookup(PC, memory);
+            if(next != NULL && next->page == entry->caller->page){
+                __atomic_store_n(&entry->caller->ret, next, __ATOMIC_RELEASE);
+            }
+            return next;
+        }
+    }
+
+    next = __atomic_load_n(&block->link[0], __ATOMIC_ACQUIRE);
+    if(next != NULL && next->start == PC){
+        return next;
+    }
+    next = __atomic_load_n(&block->link[1], __ATOMIC_ACQUIRE);
+    if(next != NULL && next->start == PC){
+        return next;
+    }
+
+    next = dpu_lookup(PC, memory);
+    if(next != NULL && next->page == block->page){
+        if(__atomic_load_n(&block->link[0], __ATOMIC_RELAXED) == NULL){
+            __atomic_store_n(&block->link[0], next, __ATOMIC_RELEASE);
+        }else{
+            __atomic_store_n(&block->link[1], next, __ATOMIC_RELEASE);
+        }
+    }
+
+    return next;
+}
+
+
+/********************************************************************
+ * Ends Block:  Returns 1 if inst changes the flow of the program: a 
+ *              branch, a PUL-return or a stop.
+ ***********************************************************************/
+int dpu_endsBlock(uint16_t inst){
+    uint16_t cir = inst;
+
+    return (COND_BRANCH) || (BRANCH) || FORMAT == 0x7 
+        || ((PUSH_PULL) && LOAD_BIT && RET_BIT);
+}
+
+
+/********************************************************************
+ * Idle:  Run a block that loops on itself, and see whether going round
+ *        changed anything besides the instruction count.  If it did 
+ *        not, and no device was touched, every turn of the loop will be
+ *        the same until an alarm goes off or the limit is reached, so 
+ *        the count is moved on by whole turns to just short of that.  
+ *        The run loop then takes the last turns as it would have.  On a
+ *        core of a multi-core run, another core may store what the loop
+ *        is waiting on, so the host thread only gives way instead.  With
+ *        no alarm or limit to wait for, the program can never leave the 
+ *        loop, and faults.  Returns the block to run next.
+ ***********************************************************************/
+struct dpu_block * dpu_idle(struct dpu_block * block, void * memory, uint64_t limit){
+    struct dpu_state before, after;
+    struct dpu_block * next;
+    uint64_t devices = bus_count;
+    uint64_t turn, until;
+    uint8_t tries;
+
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+    dpu_save(&before);
+    engines[engine_kind].runBlock(block, memory);
+    next = dpu_chain(block, memory);
+    dpu_save(&after);
+
+    turn = after.icount - before.icount;
+    after.icount = before.icount;
+    if(next != block || bus_count != devices || turn == 0
+            || memcmp(&before, &after, sizeof(before)) != 0){
+        /* Threads sharing the block may check it at once; none takes it below zero */
+        tries = __atomic_load_n(&block->idle, __ATOMIC_RELAXED);
+        while(tries > 0 && !__atomic_compare_exchange_n(&block->idle, &tries, tries - 1, 1, 
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return next;
+    }
+
+    until = alarm_next < limit ? alarm_next : limit;
+    if(smp_cores != 0){
+        sched_yield();
+    }else if(until == NO_LIMIT){
+        dpu_fault(FAULT_IDLE);
+        return NULL;
+    }else if(until > icount){
+        icount += (until - icount) / turn * turn;
+    }
+
+    return next;
+}
+
+
+/********************************************************************
+ * Side Effect:  Nonzero if inst may change memory or end the program,
+ *               which keeps its block from being taken as idle.
+ ***********************************************************************/
+int dpu_sideEffect(uint16_t inst){
+    uint16_t cir = inst;
+
+    return ((LOAD_STORE) && !LOAD_BIT) || ((PUSH_PULL) && !LOAD_BIT) 
+        || (EXTENDED);
+}
+
+
+/********************************************************************
+ * Fuse:  The FUSE_ kind word is run as, or FUSE_NONE if its pair is not
+ *        one that is fused.
+ ***********************************************************************/
+int dpu_fuse(uint32_t word){
+    uint16_t cir = word & 0xFFFF;
+
+    if(COND_BRANCH){
+        cir = word >> SHIFT_2BYTE;
+        if((IMMEDIATE) && (CMP)){
+            return FUSE_CMPI_BCC;
+        }else if((IMMEDIATE) && (SUB)){
+            return FUSE_SUBI_BCC;
+        }else if((DATA_PROC) && (DATA_CMP)){
+            return FUSE_CMP_BCC;
+        }
+    }else if((DATA_PROC) && (DATA_ADD)){
+        cir = word >> SHIFT_2BYTE;
+        if((IMMEDIATE) && (MOV)){
+            return FUSE_MOVI_ADD;
+        }
+    }else if((IMMEDIATE) && !(MOV)){
+        cir = word >> SHIFT_2BYTE;
+        if(IMMEDIATE){
+            return FUSE_IMM_IMM;
+        }
+    }
+
+    return FUSE_NONE;
+}
+
+
+/********************************************************************
+ * Invalidate:  Throw away the decoded blocks of the page holding addr.
+ *              The page is retired rather than freed, as the block being
+ *              run may belong to it; dpu_run() frees it between blocks.  A page dropped here is taken to 
+ *              be written by the program; callers dropping pages for 
+ *              other reasons clear code_written again.
+ ***********************************************************************/
+void dpu_invalidate(uint32_t addr){
+    struct dpu_page * page = code_pages[addr >> PAGE_SHIFT];
+
+    code_pages[addr >> PAGE_SHIFT] = NULL;
+    code_written[addr >> PAGE_SHIFT] = 1;
+    if(page->bytes != NULL){
+        dropped[dropped_count++] = page;
+    }else{
+        page->next = retired;
+        retired = page;
+    }
+
+    if(aot_pages[addr >> PAGE_SHIFT]){
+        aot_valid = 0;
+    }
+
+    ras_count = 0;
+    block_exit = 1;
+}
+
+
+/********************************************************************
+ * Flush:  Throw away every decoded block, for when memory has been
+ *         changed from outside the program.
+ ***********************************************************************/
+void dpu_flush(){
+    unsigned int i;
+
+    for(i = 0; i < CODE_PAGES; i++){
+        if(code_pages[i] != NULL){
+            dpu_invalidate(i << PAGE_SHIFT);
+        }
+        code_written[i] = 0;
+    }
+    dpu_reclaim();
+}
+
+
+/********************************************************************
+ * Reclaim:  Free the retired pages and their blocks.  Common pages are
+ *           given back to the cache instead.
+ ***********************************************************************/
+void dpu_reclaim(){
+    struct dpu_page * page;
+    unsigned int i;
+
+    while(dropped_count > 0){
+        dpu_pageLeave(dropped[--dropped_count]);
+    }
+    while((page = retired) != NULL){
+        retired = page->next;
+        for(i = 0; i < CODE_PAGE; i++){
+            free(page->blocks[i]);
+        }
+        free(page);
+    }
+}
+
+
+/********************************************************************
+ * Page Join:  Take the common page for page index of memory from the 
+ *             cache, putting a new one there if no thread holds one 
+ *             with the same bytes.  Returns NULL if out of memory.
+ ***********************************************************************/
+struct dpu_page * dpu_pageJoin(uint32_t index, const unsigned char * memory){
+    const unsigned char * bytes = memory + (index << PAGE_SHIFT);
+    uint64_t hash = dpu_hash(bytes, CODE_PAGE) ^ index;
+    struct dpu_page ** slot = &page_cache[hash % PAGE_BUCKETS];
+    struct dpu_page * page;
 
-            /* Check if PC is to be pulled for return. */
-            if(RET_BIT){
-                 /* If the IR flag is 1, change it to 0 so the next thumb 
-                    instruction is not executed. */
-                PC = dpu_loadReg(SP & SP_MASK, memory);
-                if(flag_ir !=0){
-                    flag_ir = 0;
-                }
-                alu = SP + REG_SIZE;
-                SP = alu;
-            }
+    pthread_mutex_lock(&page_lock);
+    for(page = *slot; page != NULL; page = page->bucket){
+        if(page->hash == hash && page->lo == index << PAGE_SHIFT
+                && memcmp(page->bytes, bytes, CODE_PAGE) == 0){
+            page->refs++;
+            pages_joined++;
+            pthread_mutex_unlock(&page_lock);
+            return page;
+        }
+    }
+
+    if((page = calloc(1, sizeof(struct dpu_page))) == NULL
+            || (page->bytes = malloc(CODE_PAGE)) == NULL){
+        pthread_mutex_unlock(&page_lock);
+        free(page);
+        return NULL;
+    }
+    memcpy(page->bytes, bytes, CODE_PAGE);
+    page->lo = index << PAGE_SHIFT;
+    page->hi = page->lo + CODE_PAGE;
+    page->hash = hash;
+    page->refs = 1;
+    page->bucket = *slot;
+    *slot = page;
+    pages_made++;
+    pthread_mutex_unlock(&page_lock);
+
+    return page;
+}
+
+
+/********************************************************************
+ * Page Leave:  Give back a common page.  The last thread to give it 
+ *              back takes it out of the cache and frees it.
+ ***********************************************************************/
+void dpu_pageLeave(struct dpu_page * page){
+    struct dpu_page ** slot;
+    unsigned int i;
+
+    pthread_mutex_lock(&page_lock);
+    if(--page->refs > 0){
+        pthread_mutex_unlock(&page_lock);
+        return;
+    }
+    for(slot = &page_cache[page->hash % PAGE_BUCKETS]; *slot != page; slot = &(*slot)->bucket);
+    *slot = page->bucket;
+    pthread_mutex_unlock(&page_lock);
+
+    for(i = 0; i < CODE_PAGE; i++){
+        free(page->blocks[i]);
+    }
+    free(page->bytes);
+    free(page);
+}
+
+
+/********************************************************************
+ * Hash:  FNV-1a hash of length bytes.
+ ***********************************************************************/
+uint64_t dpu_hash(const unsigned char * bytes, unsigned int length){
+    uint64_t hash = FNV_OFFSET;
+    unsigned int i;
+
+    for(i = 0; i < length; i++){
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+/********************************************************
+ * Fetch:  Fetch an instruction from memory, at the address
+ *         of the program counter.  Memory is 8 bits, and so
+ *         4 bytes must be collected into the MBR, starting at the
+ *         memory offset specified by MAR, as the Memory Buffer 
+ *         Register is 32 bits.  This requires bit shifting 8 bits 
+ *         to the left for each byte.  Doing this 4 times will equate 
+ *         to 32 bits read.  The PC is incremented by the size of one
+ *         register/instruction after the contents of MBR are stored in
+ *         the Instruction Register.
+ **************************************************************/         
+void dpu_fetch(void * memory){
+    uint32_t addr;
+
+    /* MAR <- PC */
+   // mar = PC;
+    
+    addr = PC;
+    if(mmu_on){
+        addr = MMU_MAP_WORD(PC, tlb_exec, MMU_EXEC, memory);
+    }
+    /* Code only runs from RAM */
+    if(DEV_HIT(addr)){
+        mar = addr;
+        dpu_fault(FAULT_MEM);
+        ir = 0;
+    }else{
+        ir = dpu_loadPhys(addr, memory);
+    }
+    
+    /* PC + 1 instruction */
+    PC += REG_SIZE;
+}
+
+/***************************************************************
+ * Load Register: Load a register with memory at location of MAR.
+ *                MAR must be set before this function is called.
+ *                The address is mapped through the MMU when it is on.
+ ******************************************************************/
+uint32_t dpu_loadReg(uint32_t marValue, void * memory){
+    if(mmu_on){
+        marValue = MMU_MAP_WORD(marValue, tlb_read, MMU_READ, memory);
+    }
+
+    return dpu_loadPhys(marValue, memory);
+}
+
+/***************************************************************
+ * Load Physical: Load a register with memory at marValue, as it 
+ *                stands.
+ ******************************************************************/
+uint32_t dpu_loadPhys(uint32_t marValue, void * memory){
+    unsigned int i;
+
+    mar = marValue;
 
+    if(mar > MEM_SIZE - CYCLES){
+        if(DEV_HIT(mar)){
+            mbr = dpu_busLoad(mar, memory);
+            return mbr;
         }
-        /* PUSH */
-        else{
-            if(RET_BIT){
-                 /* Pre-decrement */
-                alu = SP + ~REG_SIZE + 1;
-                SP = alu;
-                /* Store the Link Register/return address for jump-returns */
-                dpu_storeReg(SP & SP_MASK, LR, memory);
-            }
-            if(HIGH_BIT){
-                for(i = (RF_SIZE - 1); i >= HI_REG; i--){
-                    if(dpu_chkRList( i - HALF_RF )){
-                        alu = SP + ~REG_SIZE + 1;
-                        SP = alu;
-                        dpu_storeReg(SP & SP_MASK, regfile[i], memory);
-                    }
-                }
-            }else{
-                for(i = LOW_LIMIT; i >= 0; --i){
-                    if(dpu_chkRList(i)){
-                        alu = SP + ~REG_SIZE + 1;    
-                        SP = alu;
-                        //SP_DEC;
-                        dpu_storeReg(SP & SP_MASK, regfile[i], memory);
-                    }
-                }
-            }
+        dpu_fault(FAULT_MEM);
+        return 0;
+    }
+
+    /* MBR <- memory[MAR] */        /* PC <- + 1 instruction */
+    for(i = 0; i < CYCLES; i++, mar++){
+        mbr = mbr << SHIFT_BYTE;
+        /* Add memory at mar to mbr */
+        mbr += *((unsigned char*)memory + mar);
+    }     
+
+    /* Register <- MBR */
+    return mbr;    
+}
+
+/***************************************************************
+ * Store Register: Store an entire register into memory at MAR.
+ *                 The address is mapped through the MMU when it is on.
+ ******************************************************************/
+void dpu_storeReg(uint32_t marValue, uint32_t mbrValue, void * memory){
+    
+    if(mmu_on){
+        marValue = MMU_MAP_WORD(marValue, tlb_write, MMU_WRITE, memory);
+    }
+    mar = marValue;
+    mbr = mbrValue;
+
+    if(mar > MEM_SIZE - CYCLES){
+        if(DEV_HIT(mar)){
+            dpu_busStore(mar, mbr, memory);
+            return;
         }
+        dpu_fault(FAULT_MEM);
+        return;
     }
-    /* 
-     * Unonditional Branch 
-     */
-    else if(BRANCH){
-        if(LINK_BIT){
-            LR = PC;
-        }    
-        PC = OFFSET12;
-        /* Make sure the IR flag is not still HI after the PC has changed.
-         * If it is, IR1 will execute before a fetch is made to reach the 
-         * instruction being branched to.
-         */
-        flag_ir = 0;
-    /* 
-     * Stop 
-     */
-    }else if(STOP){
-        flag_stop = 1;
-    }    
 
-}    
+    /* Drop any decoded blocks the store overwrites */
+    if(CODE_HIT(mar, CYCLES)){
+        dpu_invalidate(mar);
+    }
+    if(CODE_HIT(mar + CYCLES - 1, 1)){
+        dpu_invalidate(mar + CYCLES - 1);
+    }
+
+    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_3BYTE & BYTE_MASK);
+    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_2BYTE & BYTE_MASK);
+    *((unsigned char*)memory + mar++) = (unsigned char)(mbr >> SHIFT_BYTE & BYTE_MASK);
+    *((unsigned char*)memory + mar) = (unsigned char)mbr & BYTE_MASK;
+
+    /* Other cores are told once the store is made */
+    if(SHARED_HIT(marValue, CYCLES) || SHARED_HIT(marValue + CYCLES - 1, 1)){
+        dpu_announce();
+    }
+}
+
+/* Engines, each built from engine.h */
+#define ENGINE(name)    name
+#define WITH_COVER      0
+#define WITH_DEBUG      0
+#define WITH_CACHE      0
+#include "engine.h"
+#undef ENGINE
+#undef WITH_COVER
+#undef WITH_DEBUG
+#undef WITH_CACHE
+
+#define ENGINE(name)    name##Cover
+#define WITH_COVER      1
+#define WITH_DEBUG      0
+#define WITH_CACHE      0
+#include "engine.h"
+#undef ENGINE
+#undef WITH_COVER
+#undef WITH_DEBUG
+#undef WITH_CACHE
+
+#define ENGINE(name)    name##Debug
+#define WITH_COVER      1
+#define WITH_DEBUG      1
+#define WITH_CACHE      0
+#include "engine.h"
+#undef ENGINE
+#undef WITH_COVER
+#undef WITH_DEBUG
+#undef WITH_CACHE
+
+#define ENGINE(name)    name##Cache
+#define WITH_COVER      0
+#define WITH_DEBUG      0
+#define WITH_CACHE      1
+#include "engine.h"
+#undef ENGINE
+#undef WITH_COVER
+#undef WITH_DEBUG
+#undef WITH_CACHE
+
 
 /*************************************************************
  *  dpu_chkbra() - Check condition code and flags, if a branch
@@ -918,3 +5955,369 @@ int iscarry(uint32_t op1,uint32_t op2, uint8_t c){
 
 
 
+
+
+/*************************************************************************
+ * dpu_lanes() - Run the program in memory as several guests at once.
+ *           Each lane starts with a copy of memory and the registers,
+ *           and the chosen register is seeded with the lane number so 
+ *           that every lane works on a different input.  The lanes run
+ *           until all have stopped, then each lane's registers are shown.
+ *           The processor's own registers are left as they were.  Lanes
+ *           share the processor's devices, MMU and TLBs, so they are not
+ *           run with the MMU on, and a lane that touches the device range
+ *           stops with FAULT_MEM instead of reaching a device.
+ ********************************************************************/
+int dpu_lanes(void * memory){
+    struct dpu_lanes * lanes;
+    struct dpu_state saved;
+    struct dpu_device devices[DEV_SLOTS];
+    unsigned char flush[BUFF_SIZE];
+    unsigned int count, seed, l;
+    uint8_t was_recording = recording;
+
+    if(mmu_on){
+        printf("Lanes cannot be run with the MMU on.\n");
+        return -1;
+    }
+
+    printf("Enter number of lanes (1-%d):\t", MAX_LANES);
+    if(scanf("%u", &count) == 0 || count == 0 || count > MAX_LANES){
+        printf("Not a valid number of lanes.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    printf("Enter register to seed with lane number in hex:\t");
+    if(scanf("%x", &seed) == 0 || seed >= RF_SIZE){
+        printf("Not a valid register.\n");
+        fgets(flush, BUFF_SIZE, stdin);
+        return -1;
+    }
+    fgets(flush, BUFF_SIZE, stdin);
+
+    if((lanes = calloc(1, sizeof(struct dpu_lanes))) == NULL){
+        perror("lanes: calloc");
+        return -1;
+    }
+    if((lanes->memory = malloc(count * MEM_SIZE)) == NULL){
+        perror("lanes: malloc");
+        free(lanes);
+        return -1;
+    }
+
+    /* Every lane begins as a copy of the processor */
+    dpu_save(&saved);
+    lanes->count = count;
+    for(l = 0; l < count; l++){
+        memcpy(lanes->memory + l * MEM_SIZE, memory, MEM_SIZE);
+        dpu_laneStore(lanes, l);
+        lanes->regfile[seed][l] = l;
+    }
+
+    /* No lane reaches a device, or is recorded */
+    memcpy(devices, bus, sizeof(bus));
+    for(l = 0; l < DEV_SLOTS; l++){
+        bus[l].load = dpu_faultLoad;
+        bus[l].store = dpu_faultStore;
+    }
+    recording = 0;
+
+    while(dpu_laneStep(lanes)){
+        ;
+    }
+
+    memcpy(bus, devices, sizeof(bus));
+    recording = was_recording;
+
+    /* Display each lane through the register dump */
+    for(l = 0; l < count; l++){
+        printf("\nLane %d:", l);
+        dpu_laneLoad(lanes, l);
+        dpu_reg();
+    }
+    dpu_restore(&saved);
+
+    free(lanes->memory);
+    free(lanes);
+
+    return 0;
+}
+
+
+/*************************************************************************
+ * dpu_laneStep() - Execute one instruction across the lanes.  The lanes
+ *           waiting at the lowest instruction address are chosen, and
+ *           of those, the lanes holding the same instruction are masked
+ *           in.  Lanes that diverged at a branch are masked off until 
+ *           the lanes behind them catch up, at which point they run 
+ *           together again.  Data processing and immediate instructions
+ *           are applied to all masked lanes at once; every other 
+ *           instruction is executed lane by lane.  Returns 0 once every
+ *           lane has stopped.
+ ********************************************************************/
+int dpu_laneStep(struct dpu_lanes * lanes){
+    unsigned char * mem;
+    uint64_t key[MAX_LANES];
+    uint64_t lead = UINT64_MAX;
+    uint16_t next[MAX_LANES];
+    unsigned int l, first = MAX_LANES;
+    uint32_t pc;
+
+    /* Find the position and next instruction of each running lane */
+    for(l = 0; l < lanes->count; l++){
+        if(lanes->flag_stop[l]){
+            continue;
+        }
+        pc = lanes->regfile[RF_PC][l];
+        /* IR1 is waiting: the PC is already past the pair */
+        if(lanes->flag_ir[l]){
+            key[l] = ((uint64_t)(pc - REG_SIZE) << SHIFT_BIT) | 1;
+            next[l] = lanes->ir[l] & 0xFFFF;
+        }else{
+            if(pc > MEM_SIZE - REG_SIZE){
+                lanes->flag_stop[l] = 1;
+                lanes->fault[l] = FAULT_MEM;
+                lanes->mar[l] = pc;
+                continue;
+            }
+            mem = lanes->memory + l * MEM_SIZE;
+            key[l] = (uint64_t)pc << SHIFT_BIT;
+            next[l] = (mem[pc] << SHIFT_BYTE) | mem[pc + 1];
+        }
+        if(key[l] < lead){
+            lead = key[l];
+            first = l;
+        }
+    }
+
+    if(first == MAX_LANES){
+        return 0;
+    }
+
+    /* Mask in the lanes that are at the same place with the same
+     * instruction */
+    cir = next[first];
+    for(l = 0; l < MAX_LANES; l++){
+        lanes->mask[l] = l < lanes->count && !lanes->flag_stop[l] 
+            && key[l] == lead && next[l] == cir;
+    }
+
+    /* Instruction cycle for each masked lane: fetch a new pair or move
+     * on to IR1 */
+    for(l = 0; l < lanes->count; l++){
+        if(!lanes->mask[l]){
+            continue;
+        }
+        if(lanes->flag_ir[l] == 0){
+            lanes->flag_ir[l] = 1;
+            mem = lanes->memory + l * MEM_SIZE;
+            pc = lanes->regfile[RF_PC][l];
+            lanes->mbr[l] = (uint32_t)mem[pc] << SHIFT_3BYTE | mem[pc + 1] << SHIFT_2BYTE
+                | mem[pc + 2] << SHIFT_BYTE | mem[pc + 3];
+            lanes->ir[l] = lanes->mbr[l];
+            lanes->mar[l] = pc + REG_SIZE;
+            lanes->regfile[RF_PC][l] = pc + REG_SIZE;
+        }else{
+            lanes->flag_ir[l] = 0;
+        }
+        lanes->cir[l] = cir;
+    }
+
+    /* Shifts and rotates loop per lane, so they are left to dpu_execute */
+    if(((DATA_PROC) && !(DATA_LSR) && !(DATA_LSL) && !(DATA_ROR)) || (IMMEDIATE)){
+        dpu_laneAlu(lanes);
+    }else{
+        for(l = 0; l < lanes->count; l++){
+            if(lanes->mask[l]){
+                dpu_laneLoad(lanes, l);
+                dpu_execute(lanes->memory + l * MEM_SIZE);
+                dpu_laneStore(lanes, l);
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/*************************************************************************
+ * dpu_laneAlu() - Execute the data processing or immediate instruction 
+ *           in cir on every masked lane.  Results are computed for all 
+ *           lanes and then merged through the mask, so the loops have
+ *           no branches and operate on whole register vectors.
+ ********************************************************************/
+void dpu_laneAlu(struct dpu_lanes * lanes){
+    uint32_t * rd = lanes->regfile[RD];
+    uint32_t * rn = lanes->regfile[RN];
+    uint32_t imm = IMM_VALUE;
+    uint32_t res[MAX_LANES];
+    uint8_t carry[MAX_LANES];
+    uint8_t * mask = lanes->mask;
+    int write = 1, setcarry = 0, setalu = 1;
+    unsigned int l;
+
+    if(DATA_PROC){
+        if(DATA_AND){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] & rn[l];
+            }
+        }else if(DATA_EOR){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] ^ rn[l];
+            }
+        }else if(DATA_SUB){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + ~rn[l] + 1;
+                carry[l] = CARRY(rd[l], ~rn[l], 1);
+            }
+            setcarry = 1;
+        }else if(DATA_SXB){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rn[l];
+            }
+        }else if(DATA_ADD){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + rn[l];
+                carry[l] = CARRY(rd[l], ~rn[l], 0);
+            }
+            setcarry = 1;
+        }else if(DATA_ADC){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + rn[l] + lanes->flag_carry[l];
+                carry[l] = CARRY(rd[l], rn[l], lanes->flag_carry[l]);
+            }
+            setcarry = 1;
+        }else if(DATA_TST){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] & rn[l];
+            }
+            write = 0;
+        }else if(DATA_TEQ){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] ^ rn[l];
+            }
+            write = 0;
+        }else if(DATA_CMP){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + ~rn[l] + 1;
+                carry[l] = CARRY(rd[l], ~rn[l], 1);
+            }
+            write = 0;
+            setcarry = 1;
+        }else if(DATA_ORR){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] | rn[l];
+            }
+        }else if(DATA_MOV){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rn[l];
+            }
+            setalu = 0;
+        }else if(DATA_BIC){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] & ~rn[l];
+            }
+        }else if(DATA_MVN){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = ~rn[l];
+            }
+        }
+    }else{
+        if(MOV){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = imm;
+            }
+            setalu = 0;
+        }else if(CMP){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + ~imm + 1;
+                carry[l] = CARRY(rd[l], ~imm, 0);
+            }
+            write = 0;
+            setcarry = 1;
+        }else if(ADD){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + imm;
+                carry[l] = CARRY(rd[l], imm, 0);
+            }
+            setcarry = 1;
+        }else if(SUB){
+            for(l = 0; l < MAX_LANES; l++){
+                res[l] = rd[l] + ~imm + 1;
+                carry[l] = CARRY(rd[l], ~imm, 1);
+            }
+            setcarry = 1;
+        }
+    }
+
+    /* Merge the results into the masked lanes */
+    for(l = 0; l < MAX_LANES; l++){
+        lanes->flag_zero[l] = mask[l] ? res[l] == 0 : lanes->flag_zero[l];
+        lanes->flag_sign[l] = mask[l] ? res[l] >> MSBTOLSB : lanes->flag_sign[l];
+    }
+    if(setcarry){
+        for(l = 0; l < MAX_LANES; l++){
+            lanes->flag_carry[l] = mask[l] ? carry[l] : lanes->flag_carry[l];
+        }
+    }
+    if(setalu){
+        for(l = 0; l < MAX_LANES; l++){
+            lanes->alu[l] = mask[l] ? res[l] : lanes->alu[l];
+        }
+    }
+    if(write){
+        for(l = 0; l < MAX_LANES; l++){
+            rd[l] = mask[l] ? res[l] : rd[l];
+        }
+    }
+}
+
+
+/*************************************************************************
+ * dpu_laneLoad() - Load the registers and flags of a lane into the 
+ *           processor.
+ ********************************************************************/
+void dpu_laneLoad(struct dpu_lanes * lanes, unsigned int lane){
+    unsigned int i;
+
+    for(i = 0; i < RF_SIZE; i++){
+        regfile[i] = lanes->regfile[i][lane];
+    }
+    mar = lanes->mar[lane];
+    mbr = lanes->mbr[lane];
+    ir = lanes->ir[lane];
+    alu = lanes->alu[lane];
+    cir = lanes->cir[lane];
+    flag_sign = lanes->flag_sign[lane];
+    flag_zero = lanes->flag_zero[lane];
+    flag_carry = lanes->flag_carry[lane];
+    flag_stop = lanes->flag_stop[lane];
+    flag_ir = lanes->flag_ir[lane];
+    fault = lanes->fault[lane];
+}
+
+
+/*************************************************************************
+ * dpu_laneStore() - Store the registers and flags of the processor into
+ *           a lane.
+ ********************************************************************/
+void dpu_laneStore(struct dpu_lanes * lanes, unsigned int lane){
+    unsigned int i;
+
+    for(i = 0; i < RF_SIZE; i++){
+        lanes->regfile[i][lane] = regfile[i];
+    }
+    lanes->mar[lane] = mar;
+    lanes->mbr[lane] = mbr;
+    lanes->ir[lane] = ir;
+    lanes->alu[lane] = alu;
+    lanes->cir[lane] = cir;
+    lanes->flag_sign[lane] = flag_sign;
+    lanes->flag_zero[lane] = flag_zero;
+    lanes->flag_carry[lane] = flag_carry;
+    lanes->flag_stop[lane] = flag_stop;
+    lanes->flag_ir[lane] = flag_ir;
+    lanes->fault[lane] = fault;
+}
@@ -6,7 +6,10 @@
  *  dpu.c function prototypes
  **********************************************/
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 
 /*  Sizes */
 #define MEM_SIZE        0x4000
@@ -68,6 +71,10 @@
 #define SEX8TO32    0xFFFFFF00
 #define MSBTOLSB    31
 
+/* Carry out of op1+op2+c, as iscarry() computes it, written without
+ * branches so it can be applied across lanes. */
+#define CARRY(op1, op2, c)  ((((op2) == MAX32) & ((c) == 1)) | ((op1) > MAX32 - (op2) - (c)))
+
 /* Stack Pointer Definitons */
 #define SP_MASK 0x3FFF
 
@@ -81,6 +88,7 @@
 #define PUSH_PULL   FORMAT == 0x5
 #define BRANCH      FORMAT == 0x6
 #define STOP        cir == 0xE000
+#define EXTENDED    FORMAT == 0x7
 
 /* Instruction Fields */
 #define OPERATION   ((cir >> 8) & 0xF)
@@ -116,6 +124,14 @@
 #define DATA_BIC 0xE == OPERATION
 #define DATA_MVN 0xF == OPERATION
 
+/* Extended OpCodes (FORMAT 0x7, with RN and RD as in data processing) */
+#define EXT_OP      ((cir >> 8) & 0x1F)
+#define EXT_SWP     0x01 == EXT_OP
+#define EXT_LDX     0x02 == EXT_OP
+#define EXT_STX     0x03 == EXT_OP
+#define EXT_CPY     0x04 == EXT_OP
+#define EXT_FIL     0x05 == EXT_OP
+
 /* Immediate OpCodes */
 #define MOV 0x0 == OPCODE
 #define CMP 0x1 == OPCODE
@@ -155,29 +171,1112 @@
 #define R6  0x40
 #define R7  0x80
 
+/* Op Numbers
+ *
+ *  Every instruction has an op number, used to name it and to count the
+ *  pairs a program runs.  Data processing instructions are numbered 
+ *  OP_DATA plus their OPERATION.
+ */
+#define OP_DATA     0x00
+#define OP_LDR      0x10
+#define OP_STR      0x11
+#define OP_LDB      0x12
+#define OP_STB      0x13
+#define OP_MOVI     0x14
+#define OP_CMPI     0x15
+#define OP_ADDI     0x16
+#define OP_SUBI     0x17
+#define OP_BCC      0x18
+#define OP_PSH      0x19
+#define OP_PUL      0x1A
+#define OP_B        0x1B
+#define OP_BL       0x1C
+#define OP_STOP     0x1D
+#define OP_SWP      0x1E
+#define OP_LDX      0x1F
+#define OP_STX      0x20
+#define OP_CPY      0x21
+#define OP_FIL      0x22
+#define OP_EXT      0x23
+#define OP_COUNT    0x24
+
 /* Forever loop */
 #define forever for(;;)
 
 
+/* Lockstep Lanes
+ *
+ *  MAX_LANES - Most guest instances that can be run side by side, one
+ *              per lane, over a shared instruction stream.
+ */
+#define MAX_LANES   0x10
+
+
+/* Block Engine
+ *
+ *    CODE_PAGE - Bytes of memory covered by one page of decoded blocks.
+ *   PAGE_SHIFT - Shift from an address to its code page.
+ *  BLOCK_WORDS - Most instruction pairs held in one block.
+ *     RAS_SIZE - Depth of the shadow return-address stack.
+ * PAGE_BUCKETS - Hash buckets of the common page cache.
+ *   FNV_OFFSET - Starting value of an FNV-1a hash.
+ *    FNV_PRIME - Multiplier of an FNV-1a hash.
+ */
+#define CODE_PAGE   0x400
+#define PAGE_SHIFT  10
+#define PAGE_MASK   (CODE_PAGE - 1)
+#define CODE_PAGES  (MEM_SIZE / CODE_PAGE)
+#define BLOCK_WORDS 0x20
+#define RAS_SIZE    0x10
+#define RAS_MASK    (RAS_SIZE - 1)
+#define PAGE_BUCKETS    0x100
+#define FNV_OFFSET      0xCBF29CE484222325ULL
+#define FNV_PRIME       0x100000001B3ULL
+
+
+/* Blocks
+ *
+ *  A block is a run of instruction pairs, fetched once from memory and
+ *  executed without going back to dpu_fetch, ending at the first pair
+ *  holding a branch, a PUL-return or a stop.  Blocks never cross a code
+ *  page, so a store into a page only has to throw away that page.
+ *
+ *  link - Blocks last seen to follow this one.  Links only join blocks 
+ *         of the same page, and one is only taken to the block starting
+ *         at the PC, so threads sharing a page can follow and patch them
+ *         without a lock.
+ *   ret - Block that a call made from this block returns to.
+ *  fuse - For each pair, the FUSE_ kind it is run as, if any.
+ *  idle - Times left to check whether the block is an idle loop, one 
+ *         that branches back to itself and changes nothing as it goes
+ *         round.  Zero for blocks that store, push, stop or use an
+ *         extended instruction.  Threads share blocks, so it is only
+ *         read and taken down atomically.
+ *
+ *  IDLE_TRIES - Checks made of a block that loops on itself before it
+ *               is taken not to be idle.
+ *
+ *  Pairs common in guest code are fused: both instructions of the word
+ *  are run by one handler, as dpu_fused() does, without going through 
+ *  dpu_execute() for each.
+ *
+ *  FUSE_CMPI_BCC - CMP immediate, then a conditional branch.
+ *   FUSE_CMP_BCC - CMP of two registers, then a conditional branch.
+ *  FUSE_SUBI_BCC - SUB immediate, then a conditional branch.
+ *  FUSE_MOVI_ADD - MOV immediate, then ADD.
+ *   FUSE_IMM_IMM - Any immediate instruction, then an ADD, SUB or CMP
+ *                  immediate.
+ *
+ *  In the last two, the second instruction sets every flag and the ALU
+ *  again, so those of the first are never seen and are not worked out.
+ *       PAIR_TOP - Pairs listed in a pair report.
+ */
+struct dpu_page;
+
+struct dpu_block {
+    uint32_t start;
+    uint32_t words;
+    uint32_t ir[BLOCK_WORDS];
+    struct dpu_block * link[2];
+    struct dpu_block * ret;
+    struct dpu_page * page;
+    uint8_t fuse[BLOCK_WORDS];
+    uint8_t idle;
+};
+
+#define IDLE_TRIES  0x2
+
+#define FUSE_NONE       0x0
+#define FUSE_CMPI_BCC   0x1
+#define FUSE_CMP_BCC    0x2
+#define FUSE_SUBI_BCC   0x3
+#define FUSE_MOVI_ADD   0x4
+#define FUSE_IMM_IMM    0x5
+#define PAIR_TOP        0x10
+
+/* Decoded blocks of one code page, by their offset into the page.  lo 
+ * and hi bound the bytes the blocks were decoded from.
+ *
+ * A page is either private to the thread that decoded it, or common: 
+ * held in the page cache and shared by every thread whose memory holds
+ * the same bytes in the page.  A common page keeps those bytes, with 
+ * their hash, and blocks are decoded from them rather than from memory.
+ * It spans the whole page, so that any store into the page drops it,
+ * and is counted in refs by each thread holding it.  bucket chains the
+ * pages of one hash bucket.  A private page keeps its own copy of the 
+ * bytes lo..hi as they were decoded, by their offset into the page, so
+ * that the thread can tell other memory holds the same code. */
+struct dpu_page {
+    struct dpu_block * blocks[CODE_PAGE];
+    struct dpu_page * next;
+    uint32_t lo;
+    uint32_t hi;
+    unsigned char copy[CODE_PAGE];
+    unsigned char * bytes;
+    uint64_t hash;
+    unsigned int refs;
+    struct dpu_page * bucket;
+};
+
+/* Nonzero if n bytes stored at addr overwrite decoded code */
+#define CODE_HIT(addr, n)   (code_pages[(addr) >> PAGE_SHIFT] != NULL \
+    && (addr) + (n) > code_pages[(addr) >> PAGE_SHIFT]->lo \
+    && (addr) < code_pages[(addr) >> PAGE_SHIFT]->hi)
+
+/* Shadow return-address stack entry: the return address and the block
+ * that made the call */
+struct dpu_ras {
+    uint32_t pc;
+    struct dpu_block * caller;
+};
+
+
+/* Engines
+ *
+ *  The instruction loop is built from engine.h once for each engine, 
+ *  with only the instrumentation that engine needs.  The engine for a 
+ *  run is picked before it starts, by ENGINE_ number.
+ *
+ *   ENGINE_FAST - Nothing extra, for plain runs.
+ *  ENGINE_COVER - Records the edges taken into cov_map, for fuzzing.
+ *  ENGINE_DEBUG - Coverage, and the breakpoints, trace and profile set
+ *                 with the x command.
+ *  ENGINE_CACHE - Notes every memory access for the cache model.
+ *   BREAK_SLOTS - Most breakpoints set at once.
+ *   PROFILE_TOP - Addresses listed in a profile.
+ */
+#define ENGINE_FAST     0x0
+#define ENGINE_COVER    0x1
+#define ENGINE_DEBUG    0x2
+#define ENGINE_CACHE    0x3
+#define ENGINES         0x4
+#define BREAK_SLOTS     0x10
+#define PROFILE_TOP     0x10
+
+struct dpu_engine {
+    void (*fetch)(void * memory);
+    void (*execute)(void * memory);
+    void (*runBlock)(struct dpu_block * block, void * memory);
+};
+
+/* Debugging for ENGINE_DEBUG runs.  A run stops before the pair at a 
+ * breakpoint, and hit is set, unless no instruction has run since 
+ * resume, so that a run stopped at a breakpoint can go on from it.
+ * profile counts the instructions run at each address, by halfword. */
+struct dpu_debug {
+    uint32_t breaks[BREAK_SLOTS];
+    unsigned int break_count;
+    FILE * trace;
+    uint64_t * profile;
+    uint64_t resume;
+    uint8_t hit;
+};
+
+/* Sampling
+ *
+ *  While sampling, a profiling timer goes off every SAMPLE_USEC of the 
+ *  processor time the emulator uses, and the pair the guest is running 
+ *  at that moment is counted.  Where the profile counts instructions, 
+ *  samples count host time, so code that is costly to emulate for the 
+ *  instructions it runs stands out.  Nothing is added to the run itself.
+ *
+ *  counts - Samples by halfword, NULL when not sampling.
+ *     aot - Samples that fell in translated code.
+ */
+#define SAMPLE_USEC     0x3E8
+
+struct dpu_sampler {
+    uint64_t * counts;
+    uint64_t aot;
+};
+
+
+/* Translated Images
+ *
+ *  An image translated to C with dpu_translate() and built as a shared
+ *  object exports the function AOT_SYMBOL, with the words it was 
+ *  translated from in AOT_ADDR/AOT_IR (AOT_COUNT of them).  The function
+ *  runs the program from a saved state until it stops or leaves the 
+ *  translated code, and returns one of:
+ *
+ *  AOT_EXIT - PC reached code that was not translated, or a device 
+ *             asked for the code to hand back.
+ *  AOT_STOP - The program stopped.
+ *   AOT_SMC - A store was made into code; the translation is stale.
+ *
+ *  The image also exports AOT_STATE, the AOT_ABI it was built against,
+ *  so that an image built for another layout of dpu_state, or another
+ *  dpu_io, is refused rather than run.  AOT_VERSION is bumped whenever
+ *  what an image is handed changes but dpu_state stays the same size.
+ *
+ *  Loads and stores past the end of RAM go back to the bus through the
+ *  dpu_io passed in.  Called with no state, the function only sets 
+ *  AOT_HOST to where the host code of each pair begins, in the order of
+ *  AOT_ADDR, followed by where the dispatch begins.
+ *
+ *  EMIT_END   - Emitted instruction never falls through.
+ *  EMIT_PC    - Emitted instruction may write the PC.
+ *  EMIT_STORE - Emitted instruction writes memory.
+ *
+ *  NODE_AOT    - Pair translated.
+ *  NODE_INTERP - Pair reached, but left to the interpreter as it holds
+ *                an extended instruction.
+ */
+#define AOT_SYMBOL  "dpu_image"
+#define AOT_COUNT   "dpu_image_count"
+#define AOT_ADDR    "dpu_image_addr"
+#define AOT_IR      "dpu_image_ir"
+#define AOT_HOST    "dpu_image_host"
+#define AOT_STATE   "dpu_image_abi"
+#define AOT_VERSION 0x2
+#define AOT_ABI     ((uint32_t)sizeof(struct dpu_state) << SHIFT_BYTE | AOT_VERSION)
+#define AOT_EXIT    0
+#define AOT_STOP    1
+#define AOT_SMC     2
+
+#define EMIT_END    0x1
+#define EMIT_PC     0x2
+#define EMIT_STORE  0x4
+
+#define NODE_AOT    0x1
+#define NODE_INTERP 0x2
+
+
+/* Perf Jitdump
+ *
+ *  The code of a translated image can be described to perf in a jitdump,
+ *  which perf inject --jit reads to name host samples by the guest pairs
+ *  they fell in.  The dump starts with a header and is followed by a 
+ *  code load record for each piece of code, holding its name and bytes.
+ *
+ *    JIT_MAGIC - First word of a jitdump.
+ *  JIT_VERSION - Version of the format written.
+ *     JIT_LOAD - Record of code loaded.
+ *     JIT_NAME - Name of the dump, by process id, which perf looks for.
+ */
+#define JIT_MAGIC   0x4A695444
+#define JIT_VERSION 0x1
+#define JIT_LOAD    0x0
+#define JIT_NAME    "jit-%d.dump"
+
+struct dpu_jitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t mach;
+    uint32_t pad;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+/* Code load record, followed by the name and then the code */
+struct dpu_jitLoad {
+    uint32_t id;
+    uint32_t size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t addr;
+    uint64_t length;
+    uint64_t index;
+};
+
+
+/* Cache simulation
+ *
+ *  The k command runs the program on the cache engine, which notes each
+ *  fetch, load, store, push and pull into a batch.  Every CACHE_BATCH 
+ *  accesses, and when the run ends, the batch is fed through a model of
+ *  split L1 instruction and data caches over a unified L2.  Each cache
+ *  is set-associative with LRU replacement, and allocates on loads and
+ *  stores alike.  An L1 miss costs the L2 latency in cycles, and an L2
+ *  miss the memory latency on top, charged to the instruction that made
+ *  the access.  Devices are not cached.
+ *
+ *     CACHE_BATCH - Accesses noted before they are fed to the model.
+ *      CACHE_WAYS - Most ways of a cache.
+ *       CACHE_TOP - Addresses listed in a cache report.
+ *     CACHE_PIECE - Most bytes of a block move or fill noted as one access.
+ *    ACCESS_FETCH - Instruction fetch, through the L1 instruction cache.
+ *     ACCESS_LOAD - LDR, LDB and PUL, through the L1 data cache.
+ *    ACCESS_STORE - STR, STB and PSH, through the L1 data cache.
+ */
+#define CACHE_BATCH     0x1000
+#define CACHE_WAYS      0x10
+#define CACHE_TOP       0x10
+#define CACHE_PIECE     0x80
+#define ACCESS_FETCH    0x0
+#define ACCESS_LOAD     0x1
+#define ACCESS_STORE    0x2
+
+/* An access, by the instruction at pc, of size bytes at addr */
+struct dpu_access {
+    uint32_t pc;
+    uint32_t addr;
+    uint8_t kind;
+    uint8_t size;
+};
+
+/* One cache of sets lines of ways each, 1 << shift bytes a line.  tags
+ * holds the line number plus one of each way, 0 if empty, and used when
+ * it was last used. */
+struct dpu_cache {
+    const char * name;
+    unsigned int size;
+    unsigned int ways;
+    unsigned int line;
+    unsigned int sets;
+    unsigned int shift;
+    uint32_t * tags;
+    uint64_t * used;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/* The cache model.  cycles and misses are kept for each address, by 
+ * halfword. */
+struct dpu_caches {
+    struct dpu_cache l1i;
+    struct dpu_cache l1d;
+    struct dpu_cache l2;
+    unsigned int l2_cycles;
+    unsigned int mem_cycles;
+    uint64_t clock;
+    uint64_t accesses;
+    uint64_t uncached;
+    uint64_t added;
+    uint64_t * cycles;
+    uint64_t * misses;
+};
+
+/* Note an access for the cache model, feeding the batch to it when full */
+#define CACHE_NOTE(at, address, type, bytes)    { \
+    cache_batch[cache_count].pc = (at); \
+    cache_batch[cache_count].addr = (address); \
+    cache_batch[cache_count].kind = (type); \
+    cache_batch[cache_count].size = (bytes); \
+    if(++cache_count == CACHE_BATCH){ \
+        dpu_cacheDrain(); \
+    } \
+}
+
+
+/* Faults
+ *
+ *  A fault stops the program and records why in fault.
+ *
+ *    FAULT_MEM - Memory accessed outside of MEM_SIZE.
+ *  FAULT_ALIGN - Atomic access to an address that is not word aligned.
+ *   FAULT_IDLE - Idle loop with no alarm or limit that could end it.
+ *   FAULT_PAGE - Access the MMU's page table does not allow.
+ */
+#define FAULT_NONE  0x0
+#define FAULT_MEM   0x1
+#define FAULT_ALIGN 0x2
+#define FAULT_IDLE  0x3
+#define FAULT_PAGE  0x4
+#define FAULT_KINDS 0x5
+
+
+/* Metrics
+ *
+ *  Each instance, the processor run from the prompt, a core or a guest
+ *  of the pool, has its counters in a dpu_metrics.  Instructions run 
+ *  bump counters of the thread running them, which are added into the
+ *  instance's every TALLY_INTERVAL instructions and when a run ends. 
+ *  The o command writes the counters of every instance to a file in 
+ *  the Prometheus text format every EXPORT_PERIOD seconds.  The file 
+ *  is written beside itself and renamed over, so it is never seen half
+ *  written.
+ *
+ *  branches - Branches taken, conditional or not.
+ *     loads - LDR and LDB instructions.
+ *    stores - STR and STB instructions.
+ *    pushes - PSH instructions.
+ *     pulls - PUL instructions.
+ *     stops - STOP instructions.
+ *    faults - Faults, by FAULT_ reason.
+ *      last - Instructions at the last export, to work out MIPS.
+ *
+ *  Instances are found through the census, one slot for each kind: 
+ *  count dpu_metrics, stride bytes apart from first.
+ */
+#define TALLY_INTERVAL  0x100000
+#define EXPORT_PERIOD   0x1
+#define EXPORT_LABEL    0x20
+#define CENSUS_MAIN     0x0
+#define CENSUS_CORES    0x1
+#define CENSUS_GUESTS   0x2
+#define CENSUS_SLOTS    0x3
+
+struct dpu_metrics {
+    uint64_t instructions;
+    uint64_t branches;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t pushes;
+    uint64_t pulls;
+    uint64_t stops;
+    uint64_t faults[FAULT_KINDS];
+    uint64_t last;
+};
+
+struct dpu_census {
+    const char * kind;
+    unsigned char * first;
+    size_t stride;
+    unsigned int count;
+};
+
+/* A counter of dpu_metrics, as exported */
+struct dpu_family {
+    const char * name;
+    const char * help;
+    size_t offset;
+};
+
+/* Add what the thread counted of field since the last tally */
+#define TALLY(field)    __atomic_store_n(&tally->field, \
+    tally->field + counts.field - tally_base.field, __ATOMIC_RELAXED)
+
+
+/* Multi-core
+ *
+ *  Cores run on their own host threads over one shared memory.  Each 
+ *  core has its own registers and decoded blocks.  Plain loads and 
+ *  stores are only ordered within the core making them; SWP, LDX and 
+ *  STX are atomic and sequentially consistent, and order every access
+ *  of the core around them.  A store into code that another core has
+ *  decoded is seen by that core by its next block.
+ *
+ *  The bytes each page's blocks were decoded from, on any core, are 
+ *  claimed in code_shared.  A core decoding a block claims its bytes 
+ *  first and then checks them again, while a core storing looks at the
+ *  claims only once its store is made, with a fence between on both 
+ *  sides; so either the decoding core sees the store, or the storing 
+ *  core sees the claim and announces it.
+ *
+ *    MAX_CORES - Most cores run at once.
+ *  GUEST_WORD  - Converts between a host word and a big-endian word as
+ *                held in guest memory.
+ */
+#define MAX_CORES   0x8
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define GUEST_WORD(v)   __builtin_bswap32(v)
+#else
+#define GUEST_WORD(v)   (v)
+#endif
+
+/* Bytes of a page, from lo up to hi */
+struct dpu_span {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+/* Nonzero if n bytes stored at addr, once stored, must be announced to
+ * the other cores */
+#define SHARED_HIT(addr, n) (smp_cores != 0 \
+    && (__atomic_thread_fence(__ATOMIC_SEQ_CST), 1) \
+    && (addr) + (n) > __atomic_load_n(&code_shared[(addr) >> PAGE_SHIFT].lo, __ATOMIC_RELAXED) \
+    && (addr) < __atomic_load_n(&code_shared[(addr) >> PAGE_SHIFT].hi, __ATOMIC_RELAXED))
+
+
+/* Device Bus
+ *
+ *  Devices are mapped above RAM, each with DEV_SPAN bytes of word-sized
+ *  registers from DEV_BASE + slot * DEV_SPAN.  A load or store past the
+ *  end of RAM goes to the bus, which passes it to the device in that 
+ *  slot.  A byte store writes the low byte of a register, and a byte 
+ *  load reads it.  A store returns what it asks of the code running:
+ *
+ *  DEV_LEAVE - Leave the block being run, as the core's own state was
+ *              changed.  Nothing decoded is stale.
+ *   DEV_CODE - Memory holding code was written; its decoded code, and 
+ *              any translation of it, is stale.
+ */
+#define DEV_BASE    MEM_SIZE
+#define DEV_SPAN    0x100
+#define DEV_SLOTS   0x4
+#define DEV_END     (DEV_BASE + DEV_SLOTS * DEV_SPAN)
+#define DEV_CONSOLE 0x0
+#define DEV_DISK    0x1
+#define DEV_TIMER   0x2
+#define DEV_MMU     0x3
+#define DEV_LEAVE   0x1
+#define DEV_CODE    0x2
+
+/* Nonzero if addr is in the device range */
+#define DEV_HIT(addr)   ((uint32_t)(addr) - DEV_BASE < DEV_END - DEV_BASE)
+
+/* Console
+ *
+ *  Output is buffered and written in one piece when the buffer fills, 
+ *  when CON_FLUSH is written, and before the next prompt.
+ *
+ *   CON_DATA - Write: a byte of output.  Read: bytes buffered.
+ *  CON_FLUSH - Write: flush the buffer.
+ */
+#define CON_DATA    0x0
+#define CON_FLUSH   0x4
+#define CON_BUFF    0x1000
+
+/* Disk
+ *
+ *  A block device backed by a file, moving whole sectors between the 
+ *  file and memory when DISK_CMD is written.
+ *
+ *  DISK_SECTOR - First sector of the transfer.
+ *    DISK_ADDR - Memory address of the transfer.
+ *   DISK_COUNT - Sectors to transfer.
+ *     DISK_CMD - Write DISK_READ or DISK_WRITE to start the transfer.
+ *  DISK_STATUS - DISK_OK, or DISK_ERROR if the last transfer failed.
+ *    DISK_SIZE - Sectors in the file.
+ */
+#define DISK_SECTOR 0x0
+#define DISK_ADDR   0x4
+#define DISK_COUNT  0x8
+#define DISK_CMD    0xC
+#define DISK_STATUS 0x10
+#define DISK_SIZE   0x14
+#define DISK_READ   0x1
+#define DISK_WRITE  0x2
+#define DISK_OK     0x0
+#define DISK_ERROR  0x1
+#define SECTOR_SIZE 0x200
+
+/* Timer
+ *
+ *  Each core has its own timer, which counts instructions and interrupts
+ *  the core every TIMER_PERIOD of them.
+ *
+ *   TIMER_COUNT - Read: low word of the instruction count.
+ *  TIMER_PERIOD - Instructions between interrupts; writing it restarts 
+ *                 the timer, and 0 stops it.
+ *  TIMER_VECTOR - Address of the interrupt handler.
+ */
+#define TIMER_COUNT     0x0
+#define TIMER_PERIOD    0x4
+#define TIMER_VECTOR    0x8
+
+/* MMU
+ *
+ *  Each core has its own MMU, which when on maps the addresses of 
+ *  fetches, loads and stores through a page table in memory.  The table
+ *  has MMU_ENTRIES words, one for each MMU_PAGE of the virtual space.  An
+ *  entry holds the address of the page it maps to, with MMU_VALID and 
+ *  the accesses allowed in the low bits.  The device range is not 
+ *  mapped.  An access the table does not allow stops the program with 
+ *  FAULT_PAGE, as does a word access that runs off the end of its page,
+ *  since the next page may map anywhere.
+ *
+ *  Mappings are kept in a direct-mapped TLB for each kind of access, 
+ *  holding only pages that allow it, so a hit is one compare and an 
+ *  add.  A store to the page of the table itself always walks the table,
+ *  and empties the TLBs, so that a changed entry is seen at once.
+ *
+ *     MMU_CTRL - MMU_ENABLE to turn the MMU on, 0 to turn it off.
+ *    MMU_TABLE - Address of the page table.
+ *    MMU_FAULT - Read: address of the last access that faulted.
+ *   MMU_VALID... - Bits of a page table entry.
+ */
+#define MMU_CTRL        0x0
+#define MMU_TABLE       0x4
+#define MMU_FAULT       0x8
+#define MMU_ENABLE      0x1
+#define MMU_VALID       0x1
+#define MMU_READ        0x2
+#define MMU_WRITE       0x4
+#define MMU_EXEC        0x8
+#define MMU_PAGE        CODE_PAGE
+#define MMU_SHIFT       PAGE_SHIFT
+#define MMU_ENTRIES     0x100
+#define MMU_NONE        MAX32
+#define TLB_SIZE        0x40
+#define TLB_MASK        (TLB_SIZE - 1)
+
+/* A TLB entry: the virtual page, and what to add to its addresses */
+struct dpu_tlb {
+    uint32_t page;
+    uint32_t delta;
+};
+
+/* Address that addr maps to for an access through tlb, walking the
+ * table on a miss.  MMU_NONE if the access faulted. */
+#define MMU_MAP(addr, tlb, access, memory) \
+    ((tlb)[((addr) >> MMU_SHIFT) & TLB_MASK].page == (addr) >> MMU_SHIFT \
+        ? (addr) + (tlb)[((addr) >> MMU_SHIFT) & TLB_MASK].delta \
+        : dpu_mmuWalk((addr), (access), (memory)))
+
+/* As MMU_MAP, for a word access, which faults if it runs off its page */
+#define MMU_SPLIT(addr) (((addr) & (MMU_PAGE - 1)) > MMU_PAGE - REG_SIZE && !DEV_HIT(addr))
+#define MMU_MAP_WORD(addr, tlb, access, memory) \
+    (MMU_SPLIT(addr) ? dpu_mmuSplit(addr) : MMU_MAP((addr), (tlb), (access), (memory)))
+
+
+/* Interrupts
+ *
+ *  An interrupt is taken between pairs.  The core pushes LR, the PC to
+ *  return to, and the flags, as PSH does, then branches to the handler
+ *  with LR holding IRQ_RETURN.  The handler is written as any other 
+ *  routine: when it returns to IRQ_RETURN, with a PUL-return or a MOV 
+ *  to the PC, the flags, PC and LR are pulled back.  No interrupt is
+ *  taken while one is being handled; it is held until the return.
+ *
+ *   IRQ_RETURN - Return address marking the end of a handler.
+ *  IRQ_SIGN... - Bits of the flags as pushed.
+ */
+#define IRQ_RETURN  0xFFFFFFF1
+#define IRQ_SIGN    0x4
+#define IRQ_ZERO    0x2
+#define IRQ_CARRY   0x1
+
+
+/* Alarms
+ *
+ *  Events due at a future instruction count, kept in a binary heap by 
+ *  count.  The run loop only compares the instruction count with the 
+ *  earliest of them once per block, and runs a pair at a time when one
+ *  is close, so that each goes off at the same instruction however the
+ *  program is run.
+ *
+ *  ALARM_SLOTS - Most alarms pending at once.
+ *  ALARM_TIMER - The timer's next interrupt.
+ */
+#define ALARM_SLOTS 0x8
+#define ALARM_TIMER 0x1
+
+struct dpu_alarm {
+    uint64_t when;
+    uint32_t type;
+    uint32_t pad;
+};
+
+
+/* Registers of a device, at a byte offset into its span.  A local 
+ * device belongs to the core, and its state is the core's own; it is
+ * not recorded and keeps running during replay. */
+struct dpu_device {
+    uint32_t (*load)(uint32_t reg, void * memory);
+    int (*store)(uint32_t reg, uint32_t value, void * memory);
+    uint8_t local;
+};
+
+struct dpu_console {
+    unsigned char buff[CON_BUFF];
+    unsigned int length;
+};
+
+struct dpu_disk {
+    FILE * file;
+    uint32_t sector;
+    uint32_t addr;
+    uint32_t count;
+    uint32_t status;
+    uint32_t size;
+};
+
+
+/* Fuzzing
+ *
+ *     FUZZ_MAP - Bytes in the edge coverage map, as used by AFL.
+ *     FUZZ_ENV - Environment variable holding the id of a shared memory
+ *                map to record coverage into, as set by AFL.
+ *  FUZZ_CORPUS - Most inputs kept for finding new coverage.
+ *   FUZZ_STACK - Most mutations stacked onto one input.
+ */
+#define FUZZ_MAP    0x10000
+#define FUZZ_MASK   (FUZZ_MAP - 1)
+#define FUZZ_ENV    "__AFL_SHM_ID"
+#define FUZZ_CORPUS 0x400
+#define FUZZ_STACK  0x8
+
+
+/* Record and Replay
+ *
+ *  A recording holds a snapshot of the processor and memory, followed by
+ *  the events that changed them from outside the program, each stamped 
+ *  with the instruction count it happened at.  Everything else about a
+ *  run follows from those, so replaying the events over the snapshot 
+ *  repeats the run exactly.
+ *
+ *        REC_MAGIC - First bytes of a recording.
+ *        EV_MEMORY - Bytes written into memory by a load or modify.
+ *         EV_RESET - Registers reset.
+ *        EV_DEVICE - Value loaded from a device.
+ *           EV_END - Recording stopped.
+ *  REPLAY_INTERVAL - Instructions between checkpoints taken while 
+ *                    replaying, to begin with.
+ *    REPLAY_POINTS - Most checkpoints kept.  Past this, every other
+ *                    checkpoint is dropped and the interval doubles.
+ *        RUN_SLACK - Budget left under which a limited run stops using
+ *                    blocks, so it cannot overshoot.
+ */
+#define REC_MAGIC       0x32555044
+#define EV_MEMORY       0x1
+#define EV_RESET        0x2
+#define EV_END          0x3
+#define EV_DEVICE       0x4
+#define REPLAY_INTERVAL 0x100000
+#define REPLAY_POINTS   0x40
+#define RUN_SLACK       (2 * BLOCK_WORDS)
+#define NO_LIMIT        UINT64_MAX
+
+/* Header of a recorded event, followed by length bytes of data */
+struct dpu_event {
+    uint64_t icount;
+    uint32_t type;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t pad;
+};
+
+
+/* Processor state
+ *
+ *  A copy of every register and flag, used to move a guest in and out
+ *  of the registers below.
+ */
+struct dpu_state {
+    uint32_t regfile[RF_SIZE];
+    uint32_t mar;
+    uint32_t mbr;
+    uint32_t ir;
+    uint32_t alu;
+    uint16_t cir;
+    uint8_t  flag_sign;
+    uint8_t  flag_zero;
+    uint8_t  flag_carry;
+    uint8_t  flag_stop;
+    uint8_t  flag_ir;
+    uint8_t  fault;
+    uint64_t icount;
+    struct dpu_alarm alarms[ALARM_SLOTS];
+    uint32_t alarm_count;
+    uint32_t timer_period;
+    uint32_t timer_vector;
+    uint8_t  flag_irq;
+    uint8_t  irq_pending;
+    uint8_t  mmu_on;
+    uint32_t mmu_table;
+    uint32_t mmu_fault;
+};
+
+
+/* Device access handed to translated code.  store returns the DEV_LEAVE
+ * and DEV_CODE bits asked of the translated code by the device. */
+struct dpu_io {
+    uint32_t (*load)(struct dpu_state * s, uint32_t addr, unsigned char * m);
+    int (*store)(struct dpu_state * s, uint32_t addr, uint32_t value, unsigned char * m);
+};
+
+
+/* Replay checkpoint: the processor, memory, and the next event to apply */
+struct dpu_checkpoint {
+    struct dpu_state state;
+    unsigned char memory[MEM_SIZE];
+    unsigned int event;
+};
+
+
+/* A recording loaded for replay
+ *
+ *     events - Event headers, with their data in data.
+ *      start - Snapshot the recording begins from.
+ *     device - Next event to look at for a device load.
+ */
+struct dpu_replay {
+    unsigned char filename[BUFF_SIZE];
+    struct dpu_checkpoint start;
+    struct dpu_event * events;
+    unsigned char ** data;
+    unsigned int count;
+    struct dpu_checkpoint * points[REPLAY_POINTS];
+    unsigned int npoints;
+    uint64_t interval;
+    unsigned int device;
+};
+
+
+/* Reverse Execution
+ *
+ *  While history is kept, a go runs in stretches of HISTORY_INTERVAL 
+ *  instructions and marks the point each stretch ends at.  A mark holds
+ *  the processor, and of memory only the pages that changed since the 
+ *  mark before, as they were at that mark; memory at the newest mark is
+ *  kept whole.  Stepping back restores the latest mark before the 
+ *  target and runs forward to it again, with the changes made from 
+ *  outside the program since taken from a log kept as a recording.
+ *  Fuzzing and replaying drop the history, as they take the processor 
+ *  somewhere its history does not lead.
+ *
+ *  HISTORY_INTERVAL - Instructions between marks.
+ *    HISTORY_POINTS - Most marks kept.  Past this, the oldest is dropped.
+ *     HISTORY_PAGES - Pages of memory compared at each mark.
+ */
+#define HISTORY_INTERVAL 0x100000
+#define HISTORY_POINTS   0x100
+#define HISTORY_PAGES    (MEM_SIZE / CODE_PAGE)
+
+struct dpu_mark {
+    struct dpu_state state;
+    unsigned char * pages[HISTORY_PAGES];
+    unsigned int event;
+};
+
+/* History kept for reverse execution
+ *
+ *      marks - Ring of marks, the oldest at first.
+ *     memory - Memory at the newest mark.
+ *        log - Events from outside the program since the oldest mark.
+ *       next - Next event of the log, after running again.
+ *      watch - Address of the word stepping back stops at a change of,
+ *              if watching.
+ */
+struct dpu_history {
+    struct dpu_mark marks[HISTORY_POINTS];
+    unsigned int first;
+    unsigned int count;
+    unsigned char memory[MEM_SIZE];
+    struct dpu_replay * log;
+    unsigned int next;
+    uint32_t watch;
+    uint8_t watching;
+};
+
+
+/* Snapshot Streams
+ *
+ *  While a stream is written, a go stops every so many instructions and
+ *  appends a snapshot to it.  Each snapshot is a delta from the one 
+ *  before: the processor state and each page of memory that changed,
+ *  XORed with what they were, so that what did not change is zero.  
+ *  The first snapshot is the base, a delta from a machine of all zeros.
+ *  Any snapshot is restored by applying the deltas up to it in order.
+ *
+ *  A delta is packed as runs: a 16-bit count of zero bytes, a 16-bit
+ *  count of literal bytes, then the literals.  A literal run ends at 
+ *  PACK_RUN zero bytes, so each run header pays for itself.
+ *
+ *   SNAP_MAGIC - First word of each snapshot.
+ *   SNAP_PAGES - Pages of memory, one bit each in pages.
+ *   SNAP_DELTA - Largest delta before packing.
+ *     PACK_RUN - Zero bytes that end a run of literals.
+ *    PACK_MOST - Most bytes counted by one run.
+ *   PACK_CHECK - Bytes packed and unpacked by dpu_packCheck(), enough 
+ *                for runs longer than PACK_MOST.
+ */
+#define SNAP_MAGIC  0x53555044
+#define SNAP_PAGES  (MEM_SIZE / CODE_PAGE)
+#define SNAP_DELTA  (sizeof(struct dpu_state) + MEM_SIZE)
+#define PACK_RUN    0x4
+#define PACK_MOST   0xFFFF
+#define PACK_CHECK  (2 * PACK_MOST + 0x13)
+
+/* Header of a snapshot, followed by length bytes of packed delta */
+struct dpu_snap {
+    uint32_t magic;
+    uint32_t pages;
+    uint64_t icount;
+    uint32_t length;
+    uint32_t pad;
+};
+
+/* pages has a bit for each page of memory */
+_Static_assert(SNAP_PAGES <= 32, "SNAP_PAGES must fit the pages bitmap of struct dpu_snap");
+
+/* Stream being written
+ *
+ *     state - Processor at the last snapshot written.
+ *    memory - Memory at the last snapshot written.
+ *  interval - Instructions between snapshots.
+ *      next - Instruction count to write the next snapshot at.
+ *     count - Snapshots written.
+ */
+struct dpu_stream {
+    FILE * file;
+    struct dpu_state state;
+    unsigned char memory[MEM_SIZE];
+    uint64_t interval;
+    uint64_t next;
+    unsigned int count;
+};
+
+
+/* Lanes
+ *
+ *  The state of each lane is kept as structure-of-arrays: every register
+ *  and flag is a vector indexed by lane, so an operation applied to all
+ *  lanes touches contiguous memory and can be vectorized by the compiler.
+ *  Only memory is kept per lane.  There are no devices, MMU or TLBs for
+ *  a lane, so lanes run with the MMU off and fault on the device range.
+ *
+ *    mask - Lanes taking part in the current step.
+ *  memory - MEM_SIZE bytes of private memory per lane.
+ */
+struct dpu_lanes {
+    uint32_t regfile[RF_SIZE][MAX_LANES];
+    uint32_t mar[MAX_LANES];
+    uint32_t mbr[MAX_LANES];
+    uint32_t ir[MAX_LANES];
+    uint32_t alu[MAX_LANES];
+    uint16_t cir[MAX_LANES];
+    uint8_t  flag_sign[MAX_LANES];
+    uint8_t  flag_zero[MAX_LANES];
+    uint8_t  flag_carry[MAX_LANES];
+    uint8_t  flag_stop[MAX_LANES];
+    uint8_t  flag_ir[MAX_LANES];
+    uint8_t  fault[MAX_LANES];
+    uint8_t  mask[MAX_LANES];
+    unsigned int count;
+    unsigned char * memory;
+};
+
+
+/* A core run on its own thread, with the memory shared by all cores */
+struct dpu_core {
+    struct dpu_state state;
+    void * memory;
+    struct dpu_metrics metrics;
+};
+
+
+/* Scheduler
+ *
+ *  Many guests are shared out over a few host threads.  Each guest runs 
+ *  for a quantum of instructions, to the end of a block, then goes to 
+ *  the back of the run queue.  A guest's context is kept to one aligned
+ *  dpu_state, and its memory is only allocated when it first runs.
+ *
+ *  MAX_GUESTS - Most guests run by the scheduler.
+ *  CACHE_LINE - Size of a host cache line.
+ */
+#define MAX_GUESTS  0x10000
+#define CACHE_LINE  0x40
+
+struct dpu_guest {
+    _Alignas(CACHE_LINE) struct dpu_state state;
+    unsigned char * memory;
+    struct dpu_metrics metrics;
+};
+
+/* Results
+ *
+ *  A scheduler run can write how each guest ended to a results file, 
+ *  laid out in columns so that a reader can map the file and scan one 
+ *  field of every guest at once.  The file begins with a dpu_resultHead
+ *  naming the regions of memory hashed, followed by row groups.  Each 
+ *  thread gathers up to RESULT_ROWS guests, then appends them as one 
+ *  group with a single write to the file opened O_APPEND, so threads 
+ *  never wait on each other and groups never interleave.  A group is a
+ *  dpu_resultGroup followed by its columns, widest first so that each 
+ *  stays aligned:
+ *
+ *     icount - uint64_t[rows], instructions the guest ran.
+ *       hash - uint64_t[regions][rows], FNV-1a of each region.
+ *         id - uint32_t[rows], guest number.
+ *    regfile - uint32_t[RF_SIZE][rows].
+ *      flags - uint8_t[rows], RESULT_SIGN/ZERO/CARRY.
+ *      fault - uint8_t[rows], FAULT_NONE if the guest ran STOP.
+ *
+ *  The group is padded to a multiple of RESULT_ALIGN bytes, and size 
+ *  gives its length in bytes, header included.
+ *
+ *    RESULT_MAGIC - First word of a results file.
+ *    RESULT_GROUP - First word of a row group.
+ *     RESULT_ROWS - Most rows in a group.
+ *  RESULT_REGIONS - Most regions of memory hashed.
+ *    RESULT_ALIGN - Alignment of every group.
+ */
+#define RESULT_MAGIC    0x52555044
+#define RESULT_GROUP    0x50524752
+#define RESULT_ROWS     0x400
+#define RESULT_REGIONS  0x4
+#define RESULT_ALIGN    0x8
+#define RESULT_SIGN     0x4
+#define RESULT_ZERO     0x2
+#define RESULT_CARRY    0x1
+
+struct dpu_resultHead {
+    uint32_t magic;
+    uint32_t regions;
+    uint32_t offset[RESULT_REGIONS];
+    uint32_t length[RESULT_REGIONS];
+};
+
+struct dpu_resultGroup {
+    uint32_t magic;
+    uint32_t rows;
+    uint32_t regions;
+    uint32_t size;
+};
+
+/* Rows gathered by one thread, column by column, until written */
+struct dpu_results {
+    uint64_t icount[RESULT_ROWS];
+    uint64_t hash[RESULT_REGIONS][RESULT_ROWS];
+    uint32_t id[RESULT_ROWS];
+    uint32_t regfile[RF_SIZE][RESULT_ROWS];
+    uint8_t  flags[RESULT_ROWS];
+    uint8_t  fault[RESULT_ROWS];
+    unsigned int rows;
+};
+
+/* Guests of a scheduler run, and the queue of those still running 
+ *
+ *    queue - Ring of guest numbers waiting for a thread, queued of them
+ *            from head.
+ *     live - Guests that have not stopped.
+ *    image - Memory every guest begins with.
+ *    start - Instruction count every guest begins at.
+ *  results - Results file, or -1 if none.
+ *   layout - Head of the results file.
+ *     rows - Rows of each thread, NULL without a results file.
+ *  workers - Threads that have taken their rows.
+ *     lost - Rows a short write kept out of the results file.
+ */
+struct dpu_sched {
+    struct dpu_guest * guests;
+    uint32_t * queue;
+    unsigned int count;
+    unsigned int head;
+    unsigned int queued;
+    unsigned int live;
+    uint64_t quantum;
+    const unsigned char * image;
+    uint64_t start;
+    int results;
+    struct dpu_resultHead layout;
+    struct dpu_results * rows;
+    unsigned int workers;
+    unsigned int lost;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+
 /* Registers 
  *  
  *  cir - Unofficial hidden register for holding the current instruction. 
  *
+ *  Everything a core owns is thread-local, so that each thread running
+ *  a core works on its own copy.
  */
-static uint32_t  regfile[RF_SIZE];
-static uint32_t  mar;
-static uint32_t  mbr;
-static uint32_t  ir;
-static uint32_t  alu;
-static uint16_t  cir;
+static __thread uint32_t  regfile[RF_SIZE];
+static __thread uint32_t  mar;
+static __thread uint32_t  mbr;
+static __thread uint32_t  ir;
+static __thread uint32_t  alu;
+static __thread uint16_t  cir;
 
 
 /* Flags */
-static uint8_t flag_sign;
-static uint8_t flag_zero;
-static uint8_t flag_carry;
-static uint8_t flag_stop;
-static uint8_t flag_ir; 
+static __thread uint8_t flag_sign;
+static __thread uint8_t flag_zero;
+static __thread uint8_t flag_carry;
+static __thread uint8_t flag_stop;
+static __thread uint8_t flag_ir; 
 
 
 /* Prototypes */
@@ -205,15 +1304,278 @@ void dpu_help();
 
 void dpu_fetch(void * memory);
 
+void dpu_instFetch(void * memory);
+
+void dpu_instFetchCover(void * memory);
+
+void dpu_instFetchDebug(void * memory);
+
+void dpu_instFetchCache(void * memory);
+
 uint32_t dpu_loadReg(uint32_t marValue, void * memory);
 
+uint32_t dpu_loadPhys(uint32_t marValue, void * memory);
+
 void dpu_storeReg(uint32_t marValue, uint32_t mbrValue, void * memory);
 
 void dpu_execute(void * memory);
 
+void dpu_executeCover(void * memory);
+
+void dpu_executeDebug(void * memory);
+
+void dpu_executeCache(void * memory);
+
 void dpu_instCycle(void * memory);
 
 void dpu_flags(uint32_t alu);
 
 int iscarry(uint32_t op1, uint32_t op2, uint8_t c);
 
+void dpu_run(void * memory, uint64_t limit, uint8_t exact);
+
+struct dpu_block * dpu_lookup(uint32_t pc, void * memory);
+
+void dpu_runBlock(struct dpu_block * block, void * memory);
+
+void dpu_runBlockCover(struct dpu_block * block, void * memory);
+
+void dpu_runBlockDebug(struct dpu_block * block, void * memory);
+
+void dpu_runBlockCache(struct dpu_block * block, void * memory);
+
+void dpu_select();
+
+void dpu_observe();
+
+int dpu_breakAt(uint32_t pc);
+
+void dpu_debugSet(void * memory);
+
+void dpu_profile(void * memory, uint64_t * counts, const char * what);
+
+int dpu_sampleSet(void * memory);
+
+void dpu_sample(int sig);
+
+int dpu_cacheSim(void * memory);
+
+int dpu_cacheSet(struct dpu_cache * cache, const char * name);
+
+void dpu_cacheDrain();
+
+int dpu_cacheLook(struct dpu_cache * cache, uint32_t line);
+
+void dpu_cacheReport(void * memory, uint64_t instructions);
+
+void dpu_cacheFree();
+
+void dpu_tallyTo(struct dpu_metrics * metrics);
+
+void dpu_tally();
+
+void dpu_enroll(unsigned int slot, const char * kind, void * first, size_t stride, unsigned int count);
+
+int dpu_metricsSet();
+
+void * dpu_exporter(void * arg);
+
+void dpu_export(FILE * out, double secs);
+
+void dpu_label(unsigned char * label, unsigned int s, unsigned int i);
+
+struct dpu_block * dpu_chain(struct dpu_block * block, void * memory);
+
+struct dpu_block * dpu_idle(struct dpu_block * block, void * memory, uint64_t limit);
+
+int dpu_sideEffect(uint16_t inst);
+
+int dpu_fuse(uint32_t word);
+
+int dpu_op(uint16_t inst);
+
+void dpu_pairs(void * memory);
+
+int dpu_chkbra();
+
+int dpu_endsBlock(uint16_t inst);
+
+void dpu_invalidate(uint32_t addr);
+
+void dpu_flush();
+
+void dpu_reclaim();
+
+struct dpu_page * dpu_pageJoin(uint32_t index, const unsigned char * memory);
+
+void dpu_pageLeave(struct dpu_page * page);
+
+uint64_t dpu_hash(const unsigned char * bytes, unsigned int length);
+
+int dpu_translate(void * memory);
+
+int dpu_emitInst(FILE * out, uint16_t inst, uint32_t next, int slot, int flags, const uint8_t * nodes);
+
+int dpu_attach(void * memory);
+
+int dpu_aotCheck(void * memory);
+
+void dpu_aot(void * memory);
+
+int dpu_jitSet();
+
+int dpu_jitWrite();
+
+int dpu_hostOrder(const void * a, const void * b);
+
+void dpu_fault(uint8_t reason);
+
+void dpu_atomic(void * memory);
+
+void dpu_bulk(void * memory);
+
+void dpu_bulkNote();
+
+void dpu_announce();
+
+void dpu_announceOver(uint32_t addr, uint32_t length);
+
+int dpu_claim(const struct dpu_block * block, const unsigned char * memory);
+
+int dpu_smp(void * memory);
+
+void * dpu_core(void * arg);
+
+int dpu_sched(void * memory);
+
+void * dpu_worker(void * arg);
+
+void dpu_rebase(const unsigned char * memory);
+
+int dpu_resultOpen(struct dpu_sched * sched);
+
+void dpu_resultAdd(struct dpu_sched * sched, struct dpu_results * rows, uint32_t id, const struct dpu_guest * guest);
+
+int dpu_resultWrite(struct dpu_sched * sched, struct dpu_results * rows);
+
+void dpu_busInit();
+
+uint32_t dpu_busLoad(uint32_t addr, void * memory);
+
+int dpu_busStore(uint32_t addr, uint32_t value, void * memory);
+
+uint32_t dpu_aotLoad(struct dpu_state * s, uint32_t addr, unsigned char * m);
+
+int dpu_aotStore(struct dpu_state * s, uint32_t addr, uint32_t value, unsigned char * m);
+
+int dpu_dirty(uint32_t addr, uint32_t length);
+
+uint32_t dpu_conLoad(uint32_t reg, void * memory);
+
+int dpu_conStore(uint32_t reg, uint32_t value, void * memory);
+
+void dpu_conFlush();
+
+int dpu_diskAttach();
+
+uint32_t dpu_diskLoad(uint32_t reg, void * memory);
+
+int dpu_diskStore(uint32_t reg, uint32_t value, void * memory);
+
+uint32_t dpu_timerLoad(uint32_t reg, void * memory);
+
+int dpu_timerStore(uint32_t reg, uint32_t value, void * memory);
+
+uint32_t dpu_mmuLoad(uint32_t reg, void * memory);
+
+int dpu_mmuStore(uint32_t reg, uint32_t value, void * memory);
+
+uint32_t dpu_mmuWalk(uint32_t addr, uint32_t access, void * memory);
+
+uint32_t dpu_mmuSplit(uint32_t addr);
+
+void dpu_mmuFlush();
+
+void dpu_alarmAdd(uint64_t when, uint32_t type);
+
+void dpu_alarmRemove(unsigned int index);
+
+void dpu_alarms(void * memory);
+
+void dpu_alarmNext();
+
+void dpu_interrupt(void * memory);
+
+void dpu_irqReturn(void * memory);
+
+void dpu_edge(uint32_t pc);
+
+int dpu_fuzz(void * memory);
+
+void dpu_mutate(unsigned char * input, unsigned int length, unsigned char ** corpus, unsigned int count);
+
+uint32_t dpu_rand();
+
+uint32_t dpu_nullLoad(uint32_t reg, void * memory);
+
+int dpu_nullStore(uint32_t reg, uint32_t value, void * memory);
+
+uint32_t dpu_faultLoad(uint32_t reg, void * memory);
+
+int dpu_faultStore(uint32_t reg, uint32_t value, void * memory);
+
+int dpu_record(void * memory);
+
+void dpu_recordEvent(uint32_t type, uint32_t addr, uint32_t length, const void * data);
+
+int dpu_replay(void * memory);
+
+struct dpu_replay * dpu_replayLoad(const unsigned char * filename);
+
+void dpu_replayFree(struct dpu_replay * rp);
+
+void dpu_replaySeek(struct dpu_replay * rp, void * memory, uint64_t target);
+
+unsigned int dpu_replayEvents(struct dpu_replay * rp, void * memory, unsigned int ev);
+
+int dpu_reverse(void * memory);
+
+void dpu_runMarked(void * memory, uint64_t limit);
+
+int dpu_historyMark(void * memory);
+
+int dpu_historyEvent(const struct dpu_event * event, const void * data);
+
+void dpu_historyFree();
+
+int dpu_historySeek(void * memory, uint64_t target);
+
+uint64_t dpu_historyReplay(void * memory, unsigned int index, uint64_t target, uint8_t watching);
+
+int dpu_stream(void * memory);
+
+int dpu_streamWrite(void * memory);
+
+void dpu_streamStop(void * memory);
+
+int dpu_streamLoad(void * memory);
+
+size_t dpu_pack(const unsigned char * in, size_t length, unsigned char * out);
+
+int dpu_unpack(const unsigned char * in, size_t length, unsigned char * out, size_t size);
+
+int dpu_packCheck();
+
+void dpu_save(struct dpu_state * state);
+
+void dpu_restore(const struct dpu_state * state);
+
+int dpu_lanes(void * memory);
+
+int dpu_laneStep(struct dpu_lanes * lanes);
+
+void dpu_laneAlu(struct dpu_lanes * lanes);
+
+void dpu_laneLoad(struct dpu_lanes * lanes, unsigned int lane);
+
+void dpu_laneStore(struct dpu_lanes * lanes, unsigned int lane);
@@ -0,0 +1,520 @@
+/**********************************************
+ *  Filename:   engine.h
+ *  
+ *  Instruction loop of the DPU, included by dpu.c once for each engine.
+ *  Before each include, dpu.c defines:
+ *
+ *      ENGINE(name) - Name of a function in this engine.
+ *       WITH_COVER  - 1 to record the edges run into cov_map.
+ *       WITH_DEBUG  - 1 to stop at breakpoints and to trace and profile
+ *                     each instruction.  Pairs are not fused, so that 
+ *                     every instruction is seen.
+ *       WITH_CACHE  - 1 to note each memory access for the cache model.
+ *
+ *  Whatever an engine leaves out costs it nothing as it runs.
+ **********************************************/
+
+/***************************************************************
+ * Instruction Fetch: Fetch the next pair for the instruction cycle,
+ *                    as dpu_fetch() does, noting it if the engine 
+ *                    keeps a cache model.
+ ******************************************************************/
+void ENGINE(dpu_instFetch)(void * memory){
+#if WITH_CACHE
+    CACHE_NOTE(PC, PC, ACCESS_FETCH, REG_SIZE);
+#endif
+    dpu_fetch(memory);
+}
+
+
+/***************************************************************
+ * Execute: Recognize instruction type, acknowledge instruction 
+ *          fields, execute instruction based on instruction field values.
+ *          Instruction field values are determined in the header.
+ ******************************************************************/
+void ENGINE(dpu_execute)(void * memory){
+    int i;
+
+    icount++;
+#if WITH_DEBUG
+    dpu_observe();
+#endif
+#if WITH_CACHE
+    cache_pc = PC - REG_SIZE + (flag_ir ? 0 : THUMB_SIZE);
+#endif
+
+    /* Recognize instruction type */
+    
+    /* 
+     * Data Processing 
+     */
+    if(DATA_PROC){
+        /* Acknowledge Operation field */
+        if(DATA_AND){
+            alu = regfile[RD] & regfile[RN];
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_EOR){
+            alu = regfile[RD] ^ regfile[RN];
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_SUB){
+            alu = regfile[RD] + ~regfile[RN] + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~regfile[RN], 1);
+            regfile[RD] = alu;
+        }else if(DATA_SXB){
+            alu = regfile[RN];
+            if((alu & MSB8_MASK) == 1){
+                alu += SEX8TO32;
+            }
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_ADD){
+            alu = regfile[RD] + regfile[RN];
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~regfile[RN], 0);
+            regfile[RD] = alu;
+        }else if(DATA_ADC){
+            alu = regfile[RD] + regfile[RN] + flag_carry; 
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], regfile[RN], flag_carry);
+            regfile[RD] = alu;
+        }else if(DATA_LSR){
+            for(i = 0; i < regfile[RN]; i++){
+                flag_carry = regfile[RN] & LSB_MASK;
+                alu = regfile[RD] >> 1;
+            }
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_LSL){
+            for(i = 0; i < regfile[RN]; i++){
+                flag_carry = regfile[RN] & LSB_MASK;
+                alu = regfile[RD] << 1;
+            }
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_TST){
+            alu = regfile[RD] & regfile[RN];
+            dpu_flags(alu);
+        }else if(DATA_TEQ){
+            alu = regfile[RD] ^ regfile[RN];
+            dpu_flags(alu);
+        }else if(DATA_CMP){
+            alu = regfile[RD] + ~regfile[RN] + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~regfile[RN], 1);
+        }else if(DATA_ROR){
+            for(i = 0; i < regfile[RN]; i++){
+                flag_carry = regfile[RD] & LSB_MASK;
+                alu = regfile[RD] >> 1;
+                /* Set the MSB of the alu to the value shifted left */
+                if(flag_carry){
+                    alu |= MSB32_MASK;
+                }
+            }
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_ORR){
+            alu = regfile[RD] | regfile[RN];
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_MOV){
+            regfile[RD] = regfile[RN];
+            dpu_flags(regfile[RD]);
+        }else if(DATA_BIC){
+            alu = regfile[RD] & ~regfile[RN];
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }else if(DATA_MVN){
+            alu = ~regfile[RN];
+            dpu_flags(alu);
+            regfile[RD] = alu;
+        }
+    }
+    /* 
+     * Load/Store 
+     */
+    else if(LOAD_STORE){
+        /* MAR <- regfile[RN] */
+        
+#if WITH_CACHE
+        CACHE_NOTE(cache_pc, regfile[RN], LOAD_BIT ? ACCESS_LOAD : ACCESS_STORE, 
+            !LOAD_BIT && BYTE_BIT ? 1 : REG_SIZE);
+#endif
+        if(LOAD_BIT){
+            counts.loads++;
+            /*Load Byte*/
+            if(BYTE_BIT){
+                regfile[RD] = dpu_loadReg(regfile[RN], memory);
+                regfile[RD] = regfile[RD] & BYTE_MASK;
+            }
+            /*Load Double Word*/
+            else{
+                regfile[RD] = dpu_loadReg(regfile[RN], memory);
+            }
+        }else{
+            counts.stores++;
+            mbr = regfile[RD];
+            /* Store one byte of the register into memory */
+            if(BYTE_BIT){
+                mar = regfile[RN];
+                mbr = regfile[RD];
+                if(mmu_on){
+                    mar = MMU_MAP(mar, tlb_write, MMU_WRITE, memory);
+                }
+                if(mar >= MEM_SIZE){
+                    if(DEV_HIT(mar)){
+                        dpu_busStore(mar, mbr & BYTE_MASK, memory);
+                    }else{
+                        dpu_fault(FAULT_MEM);
+                    }
+                }else{
+                    if(CODE_HIT(mar, 1)){
+                        dpu_invalidate(mar);
+                    }
+                    *((unsigned char*)memory + mar) = (unsigned char)mbr & BYTE_MASK;
+                    if(SHARED_HIT(mar, 1)){
+                        dpu_announce();
+                    }
+                }
+            }
+            /*Store double word*/
+            else{
+                dpu_storeReg(regfile[RN], regfile[RD], memory);
+            }
+        } 
+    /* 
+     * Immediate Operations 
+     */
+    }else if(IMMEDIATE){
+        /* Move immediate value into regfile at RD */
+        if(MOV){
+            regfile[RD] = IMM_VALUE;    
+            dpu_flags(regfile[RD]);
+        }else if(CMP){
+            alu = regfile[RD] + ~IMM_VALUE + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 0);
+        }else if(ADD){
+            alu = regfile[RD] + IMM_VALUE;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], IMM_VALUE, 0);
+            regfile[RD] = alu;
+        }else if(SUB){
+            alu = regfile[RD] + ~IMM_VALUE + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 1);
+            regfile[RD] = alu;
+        }    
+    /* 
+     * Conditonal Branch 
+     */
+    }else if(COND_BRANCH){
+        /* Check condition codes and flags */
+        if(dpu_chkbra()){
+            counts.branches++;
+            /* Add relative address as a signed 8-bit */
+            alu = PC + (int8_t)COND_ADDR;
+
+            /* If IR1 is going to be executed next, the IR flag must be
+             * set to 0.  If this is not done, IR1's instruction will be
+             * executed as it has not been changed due to not fetching new 
+             * instructions right after changing the PC.  Also, if the IR flag is 
+             * high, then the PC was pointing to two instructions after the one 
+             * that is in IR0, being the branch that just executed. We now have to 
+             * decrement the ALU value by 2 to compensate for this before commiting
+             * to the PC.
+             */
+            if(flag_ir != 0){
+                flag_ir = 0;
+                alu = alu + ~THUMB_SIZE + 1;
+            }
+            PC = alu;
+        }        
+#if WITH_COVER
+        if(cov_map != NULL){
+            dpu_edge(PC);
+        }
+#endif
+    /* 
+     * PUSH / PULL
+     */
+    }else if(PUSH_PULL){
+        /* PULL */
+        if(LOAD_BIT){
+            counts.pulls++;
+            /* High Registers */
+            if(HIGH_BIT){
+                /* Registers 8 - 15 */
+                for(i = HI_REG; i < RF_SIZE; i++){
+                    /* Registers must be represented by what bit number
+                       they occupy.  HIGH reg's subtract half the list size.*/
+                    if(dpu_chkRList( i - HALF_RF )){
+                        /*If the current index is set on the register list: */
+
+#if WITH_CACHE
+                        CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_LOAD, REG_SIZE);
+#endif
+                        /* Set MAR to be the stack pointer */
+                        regfile[i] = dpu_loadReg(SP & SP_MASK, memory);
+                        /* Post increment */
+                        alu = SP + REG_SIZE;
+                        SP = alu;
+                    }
+                }
+            }
+            /* Low Registers */
+            else{
+                /* Registers 0 - 7 */
+                for(i = 0; i <= LOW_LIMIT; i++){
+                    if(dpu_chkRList(i)){
+#if WITH_CACHE
+                        CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_LOAD, REG_SIZE);
+#endif
+                        regfile[i] = dpu_loadReg(SP & SP_MASK, memory);
+                        alu = SP + REG_SIZE;
+                        SP = alu;
+                    }
+                }
+            }
+
+            /* Check if PC is to be pulled for return. */
+            if(RET_BIT){
+                 /* If the IR flag is 1, change it to 0 so the next thumb 
+                    instruction is not executed. */
+#if WITH_CACHE
+                CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_LOAD, REG_SIZE);
+#endif
+                PC = dpu_loadReg(SP & SP_MASK, memory);
+                if(flag_ir !=0){
+                    flag_ir = 0;
+                }
+                alu = SP + REG_SIZE;
+                SP = alu;
+#if WITH_COVER
+                if(cov_map != NULL){
+                    dpu_edge(PC);
+                }
+#endif
+            }
+
+        }
+        /* PUSH */
+        else{
+            counts.pushes++;
+            if(RET_BIT){
+                 /* Pre-decrement */
+                alu = SP + ~REG_SIZE + 1;
+                SP = alu;
+#if WITH_CACHE
+                CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_STORE, REG_SIZE);
+#endif
+                /* Store the Link Register/return address for jump-returns */
+                dpu_storeReg(SP & SP_MASK, LR, memory);
+            }
+            if(HIGH_BIT){
+                for(i = (RF_SIZE - 1); i >= HI_REG; i--){
+                    if(dpu_chkRList( i - HALF_RF )){
+                        alu = SP + ~REG_SIZE + 1;
+                        SP = alu;
+#if WITH_CACHE
+                        CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_STORE, REG_SIZE);
+#endif
+                        dpu_storeReg(SP & SP_MASK, regfile[i], memory);
+                    }
+                }
+            }else{
+                for(i = LOW_LIMIT; i >= 0; --i){
+                    if(dpu_chkRList(i)){
+                        alu = SP + ~REG_SIZE + 1;    
+                        SP = alu;
+                        //SP_DEC;
+#if WITH_CACHE
+                        CACHE_NOTE(cache_pc, SP & SP_MASK, ACCESS_STORE, REG_SIZE);
+#endif
+                        dpu_storeReg(SP & SP_MASK, regfile[i], memory);
+                    }
+                }
+            }
+        }
+    }
+    /* 
+     * Unonditional Branch 
+     */
+    else if(BRANCH){
+        counts.branches++;
+        if(LINK_BIT){
+            LR = PC;
+        }    
+        PC = OFFSET12;
+#if WITH_COVER
+        if(cov_map != NULL){
+            dpu_edge(PC);
+        }
+#endif
+        /* Make sure the IR flag is not still HI after the PC has changed.
+         * If it is, IR1 will execute before a fetch is made to reach the 
+         * instruction being branched to.
+         */
+        flag_ir = 0;
+    /* 
+     * Stop 
+     */
+    }else if(STOP){
+        counts.stops++;
+        flag_stop = 1;
+    /* 
+     * Extended 
+     */
+    }else if(EXTENDED){
+        if((EXT_CPY) || (EXT_FIL)){
+#if WITH_CACHE
+            dpu_bulkNote();
+#endif
+            dpu_bulk(memory);
+        }else{
+            dpu_atomic(memory);
+        }
+    }    
+
+}    
+
+
+#if !WITH_DEBUG
+/********************************************************************
+ * Fused:  Run both instructions of word as the pair kind, as the block
+ *         engine would one after the other, with the fetch already made.
+ *         Neither first instruction can branch, touch memory or stop, 
+ *         so the pair runs through without checks between the two.
+ ***********************************************************************/
+static void ENGINE(dpu_fused)(int kind, uint32_t word){
+    icount += 2;
+    flag_ir = 0;
+    cir = word >> SHIFT_2BYTE;
+
+    switch(kind){
+        case FUSE_CMPI_BCC:
+            alu = regfile[RD] + ~IMM_VALUE + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 0);
+            break;
+        case FUSE_CMP_BCC:
+            alu = regfile[RD] + ~regfile[RN] + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~regfile[RN], 1);
+            break;
+        case FUSE_SUBI_BCC:
+            alu = regfile[RD] + ~IMM_VALUE + 1;
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 1);
+            regfile[RD] = alu;
+            break;
+        case FUSE_MOVI_ADD:
+            regfile[RD] = IMM_VALUE;
+            cir = word & 0xFFFF;
+            alu = regfile[RD] + regfile[RN];
+            dpu_flags(alu);
+            flag_carry = iscarry(regfile[RD], ~regfile[RN], 0);
+            regfile[RD] = alu;
+            return;
+        case FUSE_IMM_IMM:
+            if(MOV){
+                regfile[RD] = IMM_VALUE;
+            }else if(ADD){
+                regfile[RD] = regfile[RD] + IMM_VALUE;
+            }else if(SUB){
+                regfile[RD] = regfile[RD] + ~IMM_VALUE + 1;
+            }
+            cir = word & 0xFFFF;
+            if(CMP){
+                alu = regfile[RD] + ~IMM_VALUE + 1;
+                dpu_flags(alu);
+                flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 0);
+            }else if(ADD){
+                alu = regfile[RD] + IMM_VALUE;
+                dpu_flags(alu);
+                flag_carry = iscarry(regfile[RD], IMM_VALUE, 0);
+                regfile[RD] = alu;
+            }else{
+                alu = regfile[RD] + ~IMM_VALUE + 1;
+                dpu_flags(alu);
+                flag_carry = iscarry(regfile[RD], ~IMM_VALUE, 1);
+                regfile[RD] = alu;
+            }
+            return;
+    }
+
+    /* The conditional branch, from IR1 */
+    cir = word & 0xFFFF;
+    if(dpu_chkbra()){
+        counts.branches++;
+        alu = PC + (int8_t)COND_ADDR;
+        PC = alu;
+    }
+#if WITH_COVER
+    if(cov_map != NULL){
+        dpu_edge(PC);
+    }
+#endif
+}
+#endif
+
+
+/********************************************************************
+ * Run Block:  Execute the pairs of a block.  Each pair goes through the
+ *             same steps as the instruction cycle, including the updates
+ *             to MAR, MBR and IR a fetch would make, so the registers 
+ *             match those of a program run one instruction at a time.  The
+ *             block is left as soon as the PC moves away from the next 
+ *             pair, the program stops, or block_exit is raised.  Fused
+ *             pairs are run by one handler.
+ ***********************************************************************/
+void ENGINE(dpu_runBlock)(struct dpu_block * block, void * memory){
+    unsigned int w;
+    uint32_t next;
+
+    block_exit = 0;
+
+    for(w = 0; w < block->words; w++){
+        /* Fetch */
+#if WITH_DEBUG
+        if(dpu_breakAt(PC)){
+            return;
+        }
+#endif
+#if WITH_CACHE
+        CACHE_NOTE(PC, PC, ACCESS_FETCH, REG_SIZE);
+#endif
+        next = PC + REG_SIZE;
+        ir = block->ir[w];
+        mbr = ir;
+        mar = next;
+        PC = next;
+
+#if !WITH_DEBUG
+        if(block->fuse[w] != FUSE_NONE){
+            ENGINE(dpu_fused)(block->fuse[w], ir);
+            if(PC != next){
+                return;
+            }
+            continue;
+        }
+#endif
+
+        flag_ir = 1;
+        cir = IR0;
+        ENGINE(dpu_execute)(memory);
+        /* A taken branch drops IR1 */
+        if(flag_ir == 0 || flag_stop){
+            return;
+        }
+
+        flag_ir = 0;
+        cir = IR1;
+        ENGINE(dpu_execute)(memory);
+        if(PC != next || flag_stop || block_exit){
+            return;
+        }
+    }
+}